@@ -1,9 +1,148 @@
 #include "Automaton.h"
 
-Automaton::Automaton(std::string name, std::string rule, std::vector<uint32_t> colorScheme, std::function<void(uint32_t*, int, int, int)> seedFunction)
+Automaton::Automaton(std::string name, std::string rule, std::vector<uint32_t> colorScheme, CubeSeed seed)
 {
 	this->name = name;
 	this->rule = rule;
 	this->colorScheme = colorScheme;
-	this->seedFunction = seedFunction;
+	this->seed = seed;
+}
+
+uint32_t seedRandom(uint32_t counter, uint32_t key)
+{
+	// 10 rounds of multiplying one half by a constant and mixing the high bits with the other half and the key
+	uint32_t x0 = counter;
+	uint32_t x1 = 0;
+	for (int round = 0; round < 10; round++)
+	{
+		uint64_t product = static_cast<uint64_t>(0xd256d193u) * x0;
+		x0 = static_cast<uint32_t>(product >> 32) ^ key ^ x1;
+		x1 = static_cast<uint32_t>(product);
+		key += 0x9e3779b9u;
+	}
+	return x0;
+}
+
+void fillCubeSeed(uint8_t* cells, int width, int height, int depth, CubeSeed seed, uint32_t key, ThreadPool* threadPool)
+{
+	int xBegin = seed.getBegin(width), xEnd = seed.getEnd(width);
+	int yBegin = seed.getBegin(height), yEnd = seed.getEnd(height);
+	int zBegin = seed.getBegin(depth), zEnd = seed.getEnd(depth);
+	int numSlices = std::max(zEnd - zBegin, 0);
+	if (seed.density <= 0)
+		return;
+	auto fillSlices = [&](int begin, int end)
+	{
+		for (int z = zBegin + begin; z < zBegin + end; z++)
+		{
+			for (int y = yBegin; y < yEnd; y++)
+			{
+				for (int x = xBegin; x < xEnd; x++)
+				{
+					uint32_t index = static_cast<uint32_t>(x + y * width + z * width * height);
+					if (seedRandom(index, key) % static_cast<uint32_t>(seed.density) == 0)
+						cells[index] = 1;
+				}
+			}
+		}
+	};
+
+	if (threadPool != nullptr)
+		threadPool->parallelFor(numSlices, fillSlices);
+	else
+		fillSlices(0, numSlices);
+}
+
+std::vector<Automaton> getPresetAutomata(int width)
+{
+	return std::vector<Automaton>
+	({
+		Automaton
+		(
+			"Plasma", 
+			"B 4,5,10,14,21,25 / S 6,8,12,13,18,25 / 6",
+			{ 0, 0x7e00ff, 0xff00f0, 0xb079ff, 0x3fa3ff, 0x00bcff },
+			{ 2, 6 }
+		),
+		Automaton
+		(
+			"Regular Growth", 
+			"B 5,13,21,22 / S 4,5,6,12,13,22,25 / 3",
+			{ 0, 0xffff00, 0x7f7f00 },
+			{ 2, 10 }
+		),
+		Automaton
+		(
+			"Dissolve", 
+			"B 5,6,7,9,10,13,15,16,18,19,20,21,23 / S 8,10,12,15,17,21,26 / 4",
+			{ 0, 0x2c2c2c, 0xa6a6a6, 0x666666 },
+			{ 5, 128 }
+		),
+		Automaton
+		(
+			"Fungus", 
+			"B 5,6,7,9 / S 3,6,9,10 / 6",
+			{ 0, 0xaaa25c, 0x3d2800, 0x584317, 0x74612c, 0x8f8143 },
+			{ 2, 20 }
+		),
+		Automaton
+		(
+			"Cube", 
+			"B 1,2,3,4,5,6,7,11,16,17,21,25,26 / S 2,5,7,12,15,16,17,18,19,21,22,23,24 / 5",
+			{ 0, 0xf24c3d, 0xf29727, 0x22a699, 0xf2be22 },
+			{ 1, 2 }
+		),
+		Automaton
+		(
+			"Tetradecahedron", 
+			"B 2,3,4,11,23,24 / S 1,2,14,16,17,20,24 / 9",
+			{ 
+				0, 0x22a699, 0xf29727, 0xf24c3d, 0xf2be22, 0x1d5b79, 
+				0x468b97, 0xef6262, 0xf3aa60 
+			},
+			{ 1, 2 }
+		),
+		Automaton
+		(
+			"Life 3D", 
+			"B 7,11,12,13 / S 3,4,6,7,8,9,10,11 / 20",
+			{ 
+				0, 0x510000, 0xff0000, 0xf50003, 0xeb0005, 0xe00007, 0xd60009, 
+				0xcc000a, 0xc2000b, 0xb8000c, 0xaf000c, 0xa5000c, 0x9b000c, 
+				0x91000c, 0x88000b, 0x7e000a, 0x750009, 0x6c0007, 0x630005, 
+				0x5a0003 
+			},
+			{ 2, 10 }
+		),
+		Automaton
+		(
+			"Heartbeat", 
+			"B 4,5,6 / S 1 / 25",
+			{ 
+				0, 0xff0000, 0x1800ff, 0x0052ff, 0x0074ff, 0x008eff, 0x00a2ff, 
+				0x00b3ff, 0x00c2ff, 0x00d1e8, 0x00dfb9, 0x00eb88, 0x00f656, 
+				0x12ff00, 0x12ff00, 0x67f100, 0x8de200, 0xa7d200, 0xbdc100, 
+				0xcfb000, 0xde9d00, 0xea8900, 0xf47300, 0xfa5a00, 0xfe3c00 
+			},
+			{ 1, 2 }
+		),
+		Automaton
+		(
+			"Space Cars", 
+			"B 4,5 / S 10 / 15", 
+			{  
+				0, 0xff0000, 0xa200ff, 0xff008e, 0xff8c15, 0xfffc00, 0xffea00, 
+				0xffd800, 0xffc500, 0xffb100, 0xff9d00, 0xff8900, 0xff7300, 
+				0xff5a00, 0xff3c00 
+			},
+			{ 10, 20 }
+		),
+		Automaton
+		(
+			"Persist", 
+			"B 5,8,9 / S 2,11 / 2",
+			{ 0, 0x956bb0 },
+			{ 11, width }
+		),
+	});
 }
@@ -4,15 +4,40 @@
 #include <string>
 #include <vector>
 #include <cstdint>
-#include <functional>
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+/* Random cells within a cube of the given width at the center of the grid (clipped to the grid). Each cell has a
+   probability of 1/density of being alive. Whether a cell is alive only depends on a key and the index of the cell,
+   through seedRandom(), so a key always gives the same cells, whichever engine or thread fills them. */
+struct CubeSeed
+{
+	int density;
+	int width;
+
+	// First and one past the last coordinate of the cube along an axis of the given size
+	int getBegin(int size) const { return std::max((size - width) / 2, 0); }
+	int getEnd(int size) const { return std::min((size + width) / 2, size); }
+};
 
 struct Automaton
 {
-	Automaton(std::string name, std::string rule, std::vector<uint32_t> colorScheme, std::function<void(uint32_t*, int, int, int)> seedFunction);
+	Automaton(std::string name, std::string rule, std::vector<uint32_t> colorScheme, CubeSeed seed);
 	std::string name;
 	std::string rule;
 	std::vector<uint32_t> colorScheme;
-	std::function<void(uint32_t*, int, int, int)> seedFunction;
+	CubeSeed seed;
 };
 
+/* Philox-2x32-10 counter-based random number generator: a random number for every counter and key, without any state.
+   The seed shader of CellRulesShader has a GLSL copy, which must give the same numbers. */
+uint32_t seedRandom(uint32_t counter, uint32_t key);
+/* Set the cells of the seed to 1 (alive), leaving the other cells alone. The slices are split between the threads of
+   the pool, or filled on the calling thread without one. See CellRulesShader::seedCells() for the GPU version. */
+void fillCubeSeed(uint8_t* cells, int width, int height, int depth, CubeSeed seed, uint32_t key, ThreadPool* threadPool = nullptr);
+
+// List of the built in automata. Some of them fill the whole grid, so the seeds depend on its width.
+std::vector<Automaton> getPresetAutomata(int width);
+
 #endif // AUTOMATON_H
\ No newline at end of file
@@ -1,40 +1,83 @@
 #include "CellMeshingShader.h"
 
-CellMeshingShader::CellMeshingShader(int width, int height, int depth)
+CellMeshingShader::CellMeshingShader(int width, int height, int depth, Mode mode)
 {
+	this->mode = mode;
 	this->width = width;
 	this->height = height;
 	this->depth = depth;
-
+	const int brickSize = CellRulesShader::BRICK_SIZE;
+	const int bricksX = (width + brickSize - 1) / brickSize;
+	const int bricksY = (height + brickSize - 1) / brickSize;
+	const int bricksZ = (depth + brickSize - 1) / brickSize;
+	numBricks = bricksX * bricksY * bricksZ;
+	if (width > MAX_DIMENSION || height > MAX_DIMENSION || depth > MAX_DIMENSION)
+		throw std::invalid_argument("CellMeshingShader: grid dimensions must not exceed " + std::to_string(MAX_DIMENSION));
+	if (mode == Mode::VertexPulling && static_cast<int64_t>(width) * height * depth > MAX_VERTEX_PULLING_CELLS)
+		throw std::invalid_argument("CellMeshingShader: grid has too many cells for vertex pulling");
+	// 4 bytes per component * 2 components per vertex * 6 vertices per face, or one uint per face with vertex pulling
+	faceBytes = mode == Mode::VertexPulling ? 4 : 4 * 2 * 6;
+	meshedCellSSBO = 0;
+
+	/* Only visible faces are stored, so the mesh buffer starts out small and grows when a stage produces more faces
+	   than fit. Faces that don't fit are dropped for a frame, until the buffer has grown. */
+	glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxMeshBytes);
+	faceCapacity = std::max(width * height * depth / 16, MIN_FACE_CAPACITY);
+	// The whole buffer is bound as one shader storage block
+	faceCapacity = static_cast<int>(std::min(static_cast<GLint64>(faceCapacity), maxMeshBytes / faceBytes));
 	glGenBuffers(1, &meshSSBO);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshSSBO);
-
-	// 4 bytes per component * 4 components per vertex * 6 vertices per face * 1 face per stage (also used in CellRenderShader.cpp)
-	glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * 4 * 6 * static_cast<GLsizeiptr>(width * height * depth), nullptr, GL_DYNAMIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, faceBytes * static_cast<GLsizeiptr>(faceCapacity), nullptr, GL_DYNAMIC_DRAW);
+
+	// Draw command header (see DrawCommand in the shader) followed by the number of faces each stage tried to append
+	const GLuint drawCommand[11] = { 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	glGenBuffers(1, &drawCommandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(drawCommand), drawCommand, GL_DYNAMIC_DRAW);
+	glGenBuffers(1, &requestedFacesBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, requestedFacesBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 7 * sizeof(GLuint), nullptr, GL_STREAM_READ);
+	meshFence = 0;
+	requestedFacesPending = false;
+	maxRequestedFaces = 0;
+
+	glGenBuffers(1, &paletteBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, paletteBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, PALETTE_SIZE * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glGenBuffers(1, &brickListBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickListBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (4 + static_cast<GLsizeiptr>(numBricks)), nullptr, GL_DYNAMIC_DRAW);
 
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	std::string computeShaderSource = 
+	// Declarations shared by the per-face and the greedy meshing shaders
+	std::string meshShaderHeader =
 R"(
 #version 430 core
 
-layout(local_size_x = 2, local_size_y = 2, local_size_z = 2) in;
+#define VERTEX_PULLING $$VERTEX_PULLING
 
 uniform int stage;
-uniform uint colorScheme[128];
+// Number of faces that fit in the mesh buffer
+uniform uint faceCapacity;
+// Read the visible sides of the cells from faceMasks instead of comparing neighbor cells
+uniform bool useFaceMasks;
 
-// Input cell state
+// Input cell state. Cells are 8 bits each, packed 4 per uint (the first cell is in the lowest byte).
 layout(std430, binding = 0) buffer State
 {
 	uint cells[];
 } state;
 
+/* Packed vertex. position holds the x, y and z coordinates of the cube corner in 10 bits each (x in the lowest bits),
+   data holds the cell state in the low 8 bits and the side of the cube (see CUBE_FACES) in the bits above. The render
+   shader looks up the color of the state in the palette. */
 struct Vertex
 {
-	float x;
-	float y;
-	float z;
-	uint rgb;
+	uint position;
+	uint data;
 };
 
 // Face = 2 triangles = 6 vertices
@@ -43,11 +86,36 @@ struct Face
 	Vertex vertices[6];
 };
 
-// Output mesh
+// Output mesh, visible faces only, in no particular order
+#if VERTEX_PULLING
+// Each face is the cell index times 8 plus the side of the cube, CellRenderShader builds the vertices
+layout(std430, binding = 1) buffer Mesh
+{
+	uint faces[];
+} mesh;
+#else
 layout(std430, binding = 1) buffer Mesh
 {
 	Face faces[];
 } mesh;
+#endif
+
+// Indirect draw command for the mesh (same layout as the glDrawArraysIndirect command)
+layout(std430, binding = 3) buffer DrawCommand
+{
+	uint vertexCount;
+	uint instanceCount;
+	uint firstVertex;
+	uint baseInstance;
+	// Faces each stage (and ALL_STAGES) tried to append, including the ones that didn't fit
+	uint requestedFaces[7];
+} drawCommand;
+
+// Visible sides of each cell in bits 0 to 5, packed like the cells, see CellRulesShader::getFaceMaskSSBO
+layout(std430, binding = 4) buffer FaceMasks
+{
+	uint masks[];
+} faceMasks;
 
 const int WIDTH = $$WIDTH;
 const int HEIGHT = $$HEIGHT;
@@ -55,164 +123,525 @@ const int DEPTH = $$DEPTH;
 const int WIDTH_HEIGHT = WIDTH * HEIGHT;
 const int WIDTH_HEIGHT_DEPTH = WIDTH_HEIGHT * DEPTH;
 
-// Vertices of a cube's face, not including duplicate vertices (like when we use 2 triangles = 6 vertices)
+const int BRICK_SIZE = $$BRICK_SIZE;
+const int BRICKS_X = (WIDTH + BRICK_SIZE - 1) / BRICK_SIZE;
+const int BRICKS_Y = (HEIGHT + BRICK_SIZE - 1) / BRICK_SIZE;
+
+const int ALL_STAGES = 6;
+
+// Corners of a cube's face, not including duplicate vertices (like when we use 2 triangles = 6 vertices)
 struct CubeFace
 {
-	Vertex bottomLeft;
-	Vertex bottomRight;
-	Vertex topRight;
-	Vertex topLeft;
+	ivec3 bottomLeft;
+	ivec3 bottomRight;
+	ivec3 topRight;
+	ivec3 topLeft;
 };
 
-// Untranslated vertex data for each face (left, right, bottom, top, back, front)
+// Untranslated corners of each face (left, right, bottom, top, back, front)
 const CubeFace CUBE_FACES[6] =
 {
-	CubeFace(Vertex(0.0, 0.0, 0.0, 0), Vertex(0.0, 0.0, 1.0, 0), Vertex(0.0, 1.0, 1.0, 0), Vertex(0.0, 1.0, 0.0, 0)),
-	CubeFace(Vertex(1.0, 0.0, 0.0, 0), Vertex(1.0, 1.0, 0.0, 0), Vertex(1.0, 1.0, 1.0, 0), Vertex(1.0, 0.0, 1.0, 0)),
-	CubeFace(Vertex(0.0, 0.0, 0.0, 0), Vertex(1.0, 0.0, 0.0, 0), Vertex(1.0, 0.0, 1.0, 0), Vertex(0.0, 0.0, 1.0, 0)),
-	CubeFace(Vertex(0.0, 1.0, 0.0, 0), Vertex(0.0, 1.0, 1.0, 0), Vertex(1.0, 1.0, 1.0, 0), Vertex(1.0, 1.0, 0.0, 0)),
-	CubeFace(Vertex(0.0, 0.0, 0.0, 0), Vertex(0.0, 1.0, 0.0, 0), Vertex(1.0, 1.0, 0.0, 0), Vertex(1.0, 0.0, 0.0, 0)),
-	CubeFace(Vertex(0.0, 0.0, 1.0, 0), Vertex(1.0, 0.0, 1.0, 0), Vertex(1.0, 1.0, 1.0, 0), Vertex(0.0, 1.0, 1.0, 0))
+	CubeFace(ivec3(0, 0, 0), ivec3(0, 0, 1), ivec3(0, 1, 1), ivec3(0, 1, 0)),
+	CubeFace(ivec3(1, 0, 0), ivec3(1, 1, 0), ivec3(1, 1, 1), ivec3(1, 0, 1)),
+	CubeFace(ivec3(0, 0, 0), ivec3(1, 0, 0), ivec3(1, 0, 1), ivec3(0, 0, 1)),
+	CubeFace(ivec3(0, 1, 0), ivec3(0, 1, 1), ivec3(1, 1, 1), ivec3(1, 1, 0)),
+	CubeFace(ivec3(0, 0, 0), ivec3(0, 1, 0), ivec3(1, 1, 0), ivec3(1, 0, 0)),
+	CubeFace(ivec3(0, 0, 1), ivec3(1, 0, 1), ivec3(1, 1, 1), ivec3(0, 1, 1))
 };
 
+uint getCell(int index)
+{
+	return (state.cells[index >> 2] >> (8 * (index & 3))) & 0xff;
+}
+
+bool hasFaceMaskSide(int index, int side)
+{
+	return ((faceMasks.masks[index >> 2] >> (8 * (index & 3) + side)) & 1) != 0;
+}
+
+Vertex packVertex(ivec3 corner, uint data)
+{
+	return Vertex(uint(corner.x) | (uint(corner.y) << 10) | (uint(corner.z) << 20), data);
+}
+
+/* Append a face on the given side to the end of the mesh. The face covers size cells starting at the cell at origin, the
+   size along the normal of the side is 1. */
+void appendFace(ivec3 origin, ivec3 size, uint cellState, int side)
+{
+	uint faceIndex = atomicAdd(drawCommand.requestedFaces[stage], 1);
+	if (faceIndex >= faceCapacity)
+		return;
+	atomicAdd(drawCommand.vertexCount, 6);
+
+#if VERTEX_PULLING
+	mesh.faces[faceIndex] = (uint(origin.x + origin.y * WIDTH + origin.z * WIDTH_HEIGHT) << 3) | uint(side);
+#else
+	uint data = cellState | (uint(side) << 8);
+	CubeFace localCubeFace = CUBE_FACES[side];
+	// Scale and translate the cube face corners to the face's cells
+	Vertex bottomLeft = packVertex(origin + localCubeFace.bottomLeft * size, data);
+	Vertex bottomRight = packVertex(origin + localCubeFace.bottomRight * size, data);
+	Vertex topRight = packVertex(origin + localCubeFace.topRight * size, data);
+	Vertex topLeft = packVertex(origin + localCubeFace.topLeft * size, data);
+
+	Face face;
+	// Bottom triangle
+	face.vertices[0] = bottomLeft;
+	face.vertices[1] = bottomRight;
+	face.vertices[2] = topLeft;
+
+	// Top triangle
+	face.vertices[3] = topRight;
+	face.vertices[4] = topLeft;
+	face.vertices[5] = bottomRight;
+
+	mesh.faces[faceIndex] = face;
+#endif
+}
+
+)";
+
+	std::string computeShaderSource = meshShaderHeader +
+R"(
+// One work group meshes one brick of cells
+layout(local_size_x = $$BRICK_SIZE, local_size_y = $$BRICK_SIZE, local_size_z = $$BRICK_SIZE) in;
+
+// Bricks to mesh, generated by the brick list shader
+layout(std430, binding = 2) buffer BrickList
+{
+	uint numGroupsX;
+	uint numGroupsY;
+	uint numGroupsZ;
+	uint count;
+	uint bricks[];
+} brickList;
+
 void main()
 {
-	int index = int(gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * WIDTH + gl_GlobalInvocationID.z * WIDTH_HEIGHT);
+	// The group count is rounded up to fill a 2D grid of work groups, so some groups may have no brick
+	uint groupIndex = gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+	if (groupIndex >= brickList.count)
+		return;
+
+	uint brick = brickList.bricks[groupIndex];
+	ivec3 brickPosition = ivec3(brick % BRICKS_X, (brick / BRICKS_X) % BRICKS_Y, brick / (BRICKS_X * BRICKS_Y));
+	ivec3 position = brickPosition * BRICK_SIZE + ivec3(gl_LocalInvocationID);
+
+	int index = position.x + position.y * WIDTH + position.z * WIDTH_HEIGHT;
 	// Do not execute shader on out of bounds cell index
-	if (gl_GlobalInvocationID.x >= WIDTH || gl_GlobalInvocationID.y >= HEIGHT || gl_GlobalInvocationID.z >= DEPTH)
+	if (position.x >= WIDTH || position.y >= HEIGHT || position.z >= DEPTH)
 		return;
 
-	uint currentCell = state.cells[index];
+	uint currentCell = getCell(index);
 	if (currentCell == 0)
-	{
-		// Micro optimization to prevent writing to memory if cell won't be rendered (aka == 0) and the geometry is already in a "null state"
-		if (mesh.faces[index].vertices[0].x == 1e38)
-			return;
-	}
+		return;
 
-	const int LEFT = gl_GlobalInvocationID.x == 0 ? 0 : -1;
-	const int RIGHT = gl_GlobalInvocationID.x == WIDTH - 1 ? 0 : 1;
-	const int DOWN = gl_GlobalInvocationID.y == 0 ? 0 : -WIDTH;
-	const int UP = gl_GlobalInvocationID.y == HEIGHT - 1 ? 0 : WIDTH;
-	const int BACKWARD = gl_GlobalInvocationID.z == 0 ? 0 : -WIDTH_HEIGHT;
-	const int FORWARD = gl_GlobalInvocationID.z == DEPTH - 1 ? 0 : WIDTH_HEIGHT;
+	const int LEFT = position.x == 0 ? 0 : -1;
+	const int RIGHT = position.x == WIDTH - 1 ? 0 : 1;
+	const int DOWN = position.y == 0 ? 0 : -WIDTH;
+	const int UP = position.y == HEIGHT - 1 ? 0 : WIDTH;
+	const int BACKWARD = position.z == 0 ? 0 : -WIDTH_HEIGHT;
+	const int FORWARD = position.z == DEPTH - 1 ? 0 : WIDTH_HEIGHT;
 	const int DIRECTIONS[6] = { LEFT, RIGHT, DOWN, UP, BACKWARD, FORWARD };
-	
-	Face face;
-	for (int i = 0; i < 6; i++)
-	{
-		// Initialize with null/dummy quads to prevent vertex shader processing if this face doesn't exist
-		face.vertices[i] = Vertex(1e38, 1e38, 1e38, 0xffffffff);
-	}
 
-	uint color = colorScheme[currentCell];
-	int direction = DIRECTIONS[stage];
-	// If direction == 0, we're at the edge of the cell buffer, so render a face, else render a face if this one is alive and neighbor is dead.
-	bool needsFace = direction == 0 ? true : state.cells[index + direction] == 0;
-	if (currentCell > 0 && needsFace)
+	int firstSide = stage == ALL_STAGES ? 0 : stage;
+	int lastSide = stage == ALL_STAGES ? 5 : stage;
+	for (int side = firstSide; side <= lastSide; side++)
 	{
-		CubeFace localCubeFace = CUBE_FACES[stage];
-		localCubeFace = CUBE_FACES[stage];
-		vec3 giid = vec3(gl_GlobalInvocationID);
-		// Translate the cube face vertex data to this cell's position and set the color
-		CubeFace globalCubeFace = CubeFace
-		(
-			Vertex
-			(
-				giid.x + localCubeFace.bottomLeft.x,
-				giid.y + localCubeFace.bottomLeft.y,
-				giid.z + localCubeFace.bottomLeft.z,
-				color
-			),
-			Vertex
-			(
-				giid.x + localCubeFace.bottomRight.x,
-				giid.y + localCubeFace.bottomRight.y,
-				giid.z + localCubeFace.bottomRight.z,
-				color
-			),
-			Vertex
-			(
-				giid.x + localCubeFace.topRight.x,
-				giid.y + localCubeFace.topRight.y,
-				giid.z + localCubeFace.topRight.z,
-				color
-			),
-			Vertex
-			(
-				giid.x + localCubeFace.topLeft.x,
-				giid.y + localCubeFace.topLeft.y,
-				giid.z + localCubeFace.topLeft.z,
-				color
-			)
-		);
-
-		// Bottom triangle
-		face.vertices[0] = globalCubeFace.bottomLeft;
-		face.vertices[1] = globalCubeFace.bottomRight;
-		face.vertices[2] = globalCubeFace.topLeft;
-
-		// Top triangle
-		face.vertices[3] = globalCubeFace.topRight;
-		face.vertices[4] = globalCubeFace.topLeft;
-		face.vertices[5] = globalCubeFace.bottomRight;
+		int direction = DIRECTIONS[side];
+		// If direction == 0, we're at the edge of the cell buffer, so render a face, else render a face if the neighbor is dead.
+		bool needsFace;
+		if (useFaceMasks)
+			needsFace = hasFaceMaskSide(index, side);
+		else
+			needsFace = direction == 0 ? true : getCell(index + direction) == 0;
+		if (needsFace)
+			appendFace(position, ivec3(1), currentCell, side);
 	}
-
-	// Store the meshed face. This is the most expensive operation due to limited memory bandwidth (each face is 96 bytes).
-	mesh.faces[index] = face;
 }
 )";
 	stringReplace(computeShaderSource, "$$WIDTH", std::to_string(width));
 	stringReplace(computeShaderSource, "$$HEIGHT", std::to_string(height));
 	stringReplace(computeShaderSource, "$$DEPTH", std::to_string(depth));
+	stringReplace(computeShaderSource, "$$BRICK_SIZE", std::to_string(brickSize));
+	stringReplace(computeShaderSource, "$$VERTEX_PULLING", mode == Mode::VertexPulling ? "1" : "0");
+
+	computeProgram = createComputeProgram(computeShaderSource, "CellMeshingShader");
+
+	/* Greedy meshing: every invocation takes one row of one slice of the grid, parallel to one side of the cubes, and
+	   finds the maximal runs of visible faces of the same cell state along it. Each run is merged with the identical
+	   runs of the following rows into one rectangle, and a run that continues one of the previous row is skipped, since
+	   it is already part of that rectangle. Flat single state surfaces become a few large faces. */
+	std::string greedyShaderSource = meshShaderHeader +
+R"(
+layout(local_size_x = 64) in;
+
+// Brick flags of the cell buffer, see CellRulesShader::getBrickFlagSSBO
+layout(std430, binding = 2) buffer BrickFlags
+{
+	uint flags[];
+} brickFlags;
+
+// Side meshed by the first layer of work groups (gl_WorkGroupID.z = 0)
+uniform int firstSide;
+
+const ivec3 SIZE = ivec3(WIDTH, HEIGHT, DEPTH);
+const ivec3 NORMALS[6] = { ivec3(-1, 0, 0), ivec3(1, 0, 0), ivec3(0, -1, 0), ivec3(0, 1, 0), ivec3(0, 0, -1), ivec3(0, 0, 1) };
+// Axis along the normal of each side, and the two axes of its plane. Rows run along the U axis.
+const int NORMAL_AXIS[6] = { 0, 0, 1, 1, 2, 2 };
+const int U_AXIS[6] = { 1, 1, 0, 0, 0, 0 };
+const int V_AXIS[6] = { 2, 2, 2, 2, 1, 1 };
+
+// Cell at (u, v) of slice n
+ivec3 slicePosition(int side, int n, int u, int v)
+{
+	ivec3 position;
+	position[NORMAL_AXIS[side]] = n;
+	position[U_AXIS[side]] = u;
+	position[V_AXIS[side]] = v;
+	return position;
+}
+
+// The state of the cell if its face on this side is visible, 0 if there is no face
+uint getFaceState(int side, ivec3 position)
+{
+	int index = position.x + position.y * WIDTH + position.z * WIDTH_HEIGHT;
+	uint cell = getCell(index);
+	if (cell == 0)
+		return 0;
+	if (useFaceMasks)
+		return hasFaceMaskSide(index, side) ? cell : 0;
+	// Faces on the edge of the cell buffer are always visible
+	ivec3 neighbor = position + NORMALS[side];
+	if (any(lessThan(neighbor, ivec3(0))) || any(greaterThanEqual(neighbor, SIZE)))
+		return cell;
+	return getCell(neighbor.x + neighbor.y * WIDTH + neighbor.z * WIDTH_HEIGHT) == 0 ? cell : 0;
+}
+
+// Whether row v of slice n has a maximal run of faces of cells in faceState from u0 to u1
+bool hasRun(int side, int n, int v, int u0, int u1, uint faceState)
+{
+	if (u0 > 0 && getFaceState(side, slicePosition(side, n, u0 - 1, v)) == faceState)
+		return false;
+	if (u1 < SIZE[U_AXIS[side]] - 1 && getFaceState(side, slicePosition(side, n, u1 + 1, v)) == faceState)
+		return false;
+	for (int u = u0; u <= u1; u++)
+	{
+		if (getFaceState(side, slicePosition(side, n, u, v)) != faceState)
+			return false;
+	}
+	return true;
+}
+
+// Append the rectangle started by the run from u0 to u1 in row v, unless the run continues one of the previous row
+void appendRun(int side, int n, int v, int u0, int u1, uint faceState)
+{
+	if (v > 0 && hasRun(side, n, v - 1, u0, u1, faceState))
+		return;
+	int v1 = v;
+	while (v1 + 1 < SIZE[V_AXIS[side]] && hasRun(side, n, v1 + 1, u0, u1, faceState))
+		v1++;
+
+	ivec3 size = ivec3(1);
+	size[U_AXIS[side]] = u1 - u0 + 1;
+	size[V_AXIS[side]] = v1 - v + 1;
+	appendFace(slicePosition(side, n, u0, v), size, faceState, side);
+}
+
+bool isBrickEmpty(ivec3 position)
+{
+	ivec3 brick = position / BRICK_SIZE;
+	return brickFlags.flags[brick.x + brick.y * BRICKS_X + brick.z * BRICKS_X * BRICKS_Y] == 0;
+}
+
+void main()
+{
+	int side = firstSide + int(gl_WorkGroupID.z);
+	int n = int(gl_GlobalInvocationID.y);
+	int v = int(gl_GlobalInvocationID.x);
+	if (n >= SIZE[NORMAL_AXIS[side]] || v >= SIZE[V_AXIS[side]])
+		return;
 
-	const char* shaderSourceStr = computeShaderSource.c_str();
+	// Walk along the row one cell past its end, so the last run is appended too
+	int uSize = SIZE[U_AXIS[side]];
+	uint runState = 0;
+	int runStart = 0;
+	int u = 0;
+	while (u <= uSize)
+	{
+		uint faceState = 0;
+		int nextU = u + 1;
+		if (u < uSize)
+		{
+			ivec3 position = slicePosition(side, n, u, v);
+			// Empty bricks have no faces, so skip to the next brick
+			if (isBrickEmpty(position))
+				nextU = min((u / BRICK_SIZE + 1) * BRICK_SIZE, uSize);
+			else
+				faceState = getFaceState(side, position);
+		}
+		if (faceState != runState)
+		{
+			if (runState != 0)
+				appendRun(side, n, v, runStart, u - 1, runState);
+			runState = faceState;
+			runStart = u;
+		}
+		u = nextU;
+	}
+}
+)";
+	stringReplace(greedyShaderSource, "$$WIDTH", std::to_string(width));
+	stringReplace(greedyShaderSource, "$$HEIGHT", std::to_string(height));
+	stringReplace(greedyShaderSource, "$$DEPTH", std::to_string(depth));
+	stringReplace(greedyShaderSource, "$$BRICK_SIZE", std::to_string(brickSize));
+	stringReplace(greedyShaderSource, "$$VERTEX_PULLING", "0");
+
+	greedyProgram = 0;
+	if (mode == Mode::Greedy)
+		greedyProgram = createComputeProgram(greedyShaderSource, "CellMeshingShader greedy");
+
+	/* Only bricks with non-zero cells can have faces. All 6 stages of a frame mesh the same cell buffer, so the list is
+	   only built once per frame. */
+	std::string brickListShaderSource =
+R"(
+#version 430 core
 
-	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
-	glShaderSource(shader, 1, &shaderSourceStr, nullptr);
-	glCompileShader(shader);
-	std::cout << "CellMeshingShader compilation:" << std::endl;
-	printShaderCompileErrors(shader);
-	std::cout << std::endl;
+layout(local_size_x = 64) in;
 
-	computeProgram = glCreateProgram();
-	glAttachShader(computeProgram, shader);
-	glLinkProgram(computeProgram);
+layout(std430, binding = 0) buffer BrickFlags
+{
+	uint flags[];
+} brickFlags;
 
-	glDeleteShader(shader);
+layout(std430, binding = 2) buffer BrickList
+{
+	uint numGroupsX;
+	uint numGroupsY;
+	uint numGroupsZ;
+	uint count;
+	uint bricks[];
+} brickList;
+
+const int NUM_BRICKS = $$NUM_BRICKS;
+// Work groups are laid out in rows of this many groups, since the number of groups in one dimension is limited
+const uint MAX_GROUPS_X = 1024;
+
+void main()
+{
+	int brick = int(gl_GlobalInvocationID.x);
+	if (brick >= NUM_BRICKS)
+		return;
+
+	if (brickFlags.flags[brick] != 0)
+	{
+		uint i = atomicAdd(brickList.count, 1);
+		brickList.bricks[i] = uint(brick);
+		atomicMax(brickList.numGroupsX, min(i + 1, MAX_GROUPS_X));
+		atomicMax(brickList.numGroupsY, i / MAX_GROUPS_X + 1);
+	}
+}
+)";
+	stringReplace(brickListShaderSource, "$$NUM_BRICKS", std::to_string(numBricks));
+	brickListProgram = createComputeProgram(brickListShaderSource, "CellMeshingShader brick list");
 
 	stageUniformLocation = glGetUniformLocation(computeProgram, "stage");
-	colorSchemeUniformLocation = glGetUniformLocation(computeProgram, "colorScheme");
+	faceCapacityUniformLocation = glGetUniformLocation(computeProgram, "faceCapacity");
+	useFaceMasksUniformLocation = glGetUniformLocation(computeProgram, "useFaceMasks");
+	if (mode == Mode::Greedy)
+	{
+		greedyStageUniformLocation = glGetUniformLocation(greedyProgram, "stage");
+		greedyFaceCapacityUniformLocation = glGetUniformLocation(greedyProgram, "faceCapacity");
+		greedyUseFaceMasksUniformLocation = glGetUniformLocation(greedyProgram, "useFaceMasks");
+		greedyFirstSideUniformLocation = glGetUniformLocation(greedyProgram, "firstSide");
+	}
 }
 
 CellMeshingShader::~CellMeshingShader()
 {
 	glDeleteBuffers(1, &meshSSBO);
+	glDeleteBuffers(1, &drawCommandBuffer);
+	glDeleteBuffers(1, &requestedFacesBuffer);
+	glDeleteBuffers(1, &paletteBuffer);
+	if (meshFence != 0)
+		glDeleteSync(meshFence);
+	glDeleteBuffers(1, &brickListBuffer);
 	glDeleteProgram(computeProgram);
+	glDeleteProgram(greedyProgram);
+	glDeleteProgram(brickListProgram);
 }
 
-void CellMeshingShader::meshCells(GLuint cellSSBO, int stage, const std::vector<GLuint>& colorScheme)
+void CellMeshingShader::meshCells(GLuint cellSSBO, GLuint brickFlagSSBO, int stage, const std::vector<GLuint>& colorScheme, GLuint faceMaskSSBO)
 {
-	glUseProgram(computeProgram);
-	glUniform1i(stageUniformLocation, stage);
-	glUniform1uiv(colorSchemeUniformLocation, colorScheme.size(), colorScheme.data());
+	// A frame starts at stage 0, or is meshed at once with ALL_STAGES
+	bool firstStage = stage == 0 || stage == ALL_STAGES;
+	bool lastStage = stage == 5 || stage == ALL_STAGES;
+	if (firstStage)
+		growMeshBuffer();
+	// The greedy shader walks every row of the grid and checks the brick flags itself
+	if (firstStage && mode != Mode::Greedy)
+	{
+		// Reset the brick list header to 0 bricks, dispatched as 0x1x1 work groups
+		const GLuint brickListHeader[4] = { 0, 1, 1, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickListBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(brickListHeader), brickListHeader);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, brickFlagSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, brickListBuffer);
+		glUseProgram(brickListProgram);
+		glDispatchCompute((numBricks + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	}
 
-	// Allow compute program to access these buffers at binding points 0 and 1
+	// The palette only changes with the automaton, so it is only uploaded then
+	if (colorScheme != palette)
+	{
+		palette = colorScheme;
+		std::vector<GLuint> colors(PALETTE_SIZE, 0);
+		std::copy_n(colorScheme.begin(), std::min(colorScheme.size(), colors.size()), colors.begin());
+		glBindBuffer(GL_UNIFORM_BUFFER, paletteBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, PALETTE_SIZE * sizeof(GLuint), colors.data());
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	/* The mesh buffer only holds one stage at a time, so start an empty draw command. At the first stage of a frame the
+	   requested face counts of all stages are reset as well. */
+	const GLuint drawCommand[11] = { 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, firstStage ? sizeof(drawCommand) : 4 * sizeof(GLuint), drawCommand);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Allow compute program to access these buffers at binding points 0 to 3
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cellSSBO);
+	meshedCellSSBO = cellSSBO;
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, meshSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, drawCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, faceMaskSSBO);
 
-	// Dispath shader in groups of 2x2x2 to align with 'layout' declaration in shader source. (x + 1) / 2 rounds up in case of odd dimensions.
-	glDispatchCompute((width + 1) / 2, (height + 1) / 2, (depth + 1) / 2);
-	// Prevents future operations on buffers until shader is done writing to them.
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	if (mode == Mode::Greedy)
+	{
+		glUseProgram(greedyProgram);
+		glUniform1i(greedyStageUniformLocation, stage);
+		glUniform1ui(greedyFaceCapacityUniformLocation, static_cast<GLuint>(faceCapacity));
+		glUniform1i(greedyUseFaceMasksUniformLocation, faceMaskSSBO != 0);
+		glUniform1i(greedyFirstSideUniformLocation, stage == ALL_STAGES ? 0 : stage);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, brickFlagSSBO);
+
+		// One invocation per row (x) of each slice (y) of each meshed side (z)
+		int maxDimension = std::max(width, std::max(height, depth));
+		glDispatchCompute((maxDimension + 63) / 64, maxDimension, stage == ALL_STAGES ? 6 : 1);
+	}
+	else
+	{
+		glUseProgram(computeProgram);
+		glUniform1i(stageUniformLocation, stage);
+		glUniform1ui(faceCapacityUniformLocation, static_cast<GLuint>(faceCapacity));
+		glUniform1i(useFaceMasksUniformLocation, faceMaskSSBO != 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, brickListBuffer);
+
+		// Dispatch one work group per brick in the brick list
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, brickListBuffer);
+		glDispatchComputeIndirect(0);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	}
+	// The mesh is read as vertex data and the draw command by glDrawArraysIndirect
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
 
 	glUseProgram(0);
+
+	if (lastStage)
+		copyRequestedFaces();
 }
 
 GLuint CellMeshingShader::getMeshSSBO()
 {
 	return meshSSBO;
 }
+
+GLuint CellMeshingShader::getMeshedCellSSBO()
+{
+	return meshedCellSSBO;
+}
+
+CellMeshingShader::Mode CellMeshingShader::getMode()
+{
+	return mode;
+}
+
+GLuint CellMeshingShader::getDrawCommandBuffer()
+{
+	return drawCommandBuffer;
+}
+
+GLuint CellMeshingShader::getPaletteBuffer()
+{
+	return paletteBuffer;
+}
+
+bool CellMeshingShader::isMeshTruncated()
+{
+	readRequestedFaces();
+	return maxRequestedFaces > static_cast<GLuint>(faceCapacity) && faceCapacity < maxMeshBytes / faceBytes;
+}
+
+void CellMeshingShader::copyRequestedFaces()
+{
+	/* Copy the face counts somewhere no later frame writes to, so a later frame can read them without waiting for the
+	   GPU. If the previous copy hasn't been read yet, this is done once it has been, as long as no stage was meshed
+	   since. */
+	if (meshFence != 0)
+	{
+		requestedFacesPending = true;
+		return;
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, drawCommandBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, requestedFacesBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 4 * sizeof(GLuint), 0, 7 * sizeof(GLuint));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	meshFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	requestedFacesPending = false;
+}
+
+void CellMeshingShader::readRequestedFaces()
+{
+	// Only read the copied face counts once the GPU is done with them, so this never stalls
+	if (meshFence == 0 || glClientWaitSync(meshFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		return;
+	glDeleteSync(meshFence);
+	meshFence = 0;
+
+	GLuint requestedFaces[7];
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, requestedFacesBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(requestedFaces), requestedFaces);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	maxRequestedFaces = *std::max_element(requestedFaces, requestedFaces + 7);
+
+	if (requestedFacesPending)
+		copyRequestedFaces();
+}
+
+void CellMeshingShader::growMeshBuffer()
+{
+	readRequestedFaces();
+	if (maxRequestedFaces > static_cast<GLuint>(faceCapacity))
+	{
+		// Leave some room so a growing automaton doesn't need a new buffer every frame
+		GLint64 newCapacity = std::min(static_cast<GLint64>(maxRequestedFaces) * 3 / 2, static_cast<GLint64>(width) * height * depth * 6);
+		newCapacity = std::min(newCapacity, maxMeshBytes / faceBytes);
+		if (newCapacity > faceCapacity)
+		{
+			faceCapacity = static_cast<int>(newCapacity);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshSSBO);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, faceBytes * static_cast<GLsizeiptr>(faceCapacity), nullptr, GL_DYNAMIC_DRAW);
+		}
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
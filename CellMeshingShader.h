@@ -4,26 +4,108 @@
 #include <GL/glew.h>
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #include "Util.h"
+#include "CellRulesShader.h"
 
 class CellMeshingShader
 {
 public:
-	CellMeshingShader(int width, int height, int depth);
+	/* Faces emits one face for every visible side of a cell. Greedy merges neighboring faces of cells in the same state
+	   on the same plane into rectangles, which needs far fewer triangles for large flat surfaces. VertexPulling only
+	   lists the visible faces as 4 byte (cell, side) IDs, and CellRenderShader builds the vertices from the list and the
+	   cell buffer, so the mesh buffer is 12 times smaller than with Faces. */
+	enum class Mode
+	{
+		Faces,
+		Greedy,
+		VertexPulling
+	};
+	// Stage which meshes every side of the cubes
+	static const int ALL_STAGES = 6;
+	// Vertex coordinates are packed in 10 bits, so no side of the grid can be longer than this
+	static const int MAX_DIMENSION = 1023;
+	// Faces of Mode::VertexPulling store the cell index in 29 bits
+	static const int64_t MAX_VERTEX_PULLING_CELLS = static_cast<int64_t>(1) << 29;
+	// Number of colors in the palette buffer, one per possible cell state
+	static const int PALETTE_SIZE = 256;
+
+	CellMeshingShader(int width, int height, int depth, Mode mode = Mode::Faces);
 	virtual ~CellMeshingShader();
 
-	void meshCells(GLuint cellSSBO, int stage, const std::vector<GLuint>& colorScheme);
+	/* Mesh the visible faces of one side of the cubes into a compact list of faces, replacing the previous stage.
+	   brickFlagSSBO has one flag per brick of CellRulesShader::BRICK_SIZE^3 cells (see CellRulesShader::getBrickFlagSSBO)
+	   and only bricks which contain non-zero cells are meshed. The list of those bricks is built at stage 0, so all 6
+	   stages of a frame must be meshed in order from the same cell buffer.
+	   With stage == ALL_STAGES the faces of all 6 sides are meshed in one dispatch, so the mesh can be drawn at once.
+	   Vertices store the cell state, colorScheme (RGB888 color of each state) is copied to the palette buffer.
+	   If faceMaskSSBO is not 0, the visible sides of the cells are read from it instead of from the neighbor cells, see
+	   CellRulesShader::getFaceMaskSSBO. The face counts of CellRulesShader::getFaceCountSSBO can then be passed as the
+	   brick flags, so bricks without visible faces, like the inside of a solid blob, are skipped too. */
+	void meshCells(GLuint cellSSBO, GLuint brickFlagSSBO, int stage, const std::vector<GLuint>& colorScheme, GLuint faceMaskSSBO = 0);
 	GLuint getMeshSSBO();
+	/* The cell buffer the mesh was last built from. With Mode::VertexPulling the render shader reads the cell states
+	   from it, so it must not be changed until the cells are meshed again. */
+	GLuint getMeshedCellSSBO();
+	Mode getMode();
+	// glDrawArraysIndirect command which draws the faces of the last meshed stage
+	GLuint getDrawCommandBuffer();
+	/* Uniform buffer with the colors of the cell states, PALETTE_SIZE tightly packed uints. std140 pads every array element
+	   to 16 bytes, so shaders read it as an array of PALETTE_SIZE / 4 uvec4s. */
+	GLuint getPaletteBuffer();
+	/* Whether faces of an earlier frame didn't fit in the mesh buffer and meshing again would grow it. The mesh stays
+	   valid until the cells change, but a truncated mesh should be rebuilt even if they didn't. Never waits for the GPU,
+	   so this is only known a frame or two after meshing. */
+	bool isMeshTruncated();
 private:
+	static const int MIN_FACE_CAPACITY = 65536;
+
+	// Reallocate the mesh buffer if the last frame produced more faces than fit
+	void growMeshBuffer();
+	// Copy the requested face counts of the last meshed frame to requestedFacesBuffer, once the previous copy was read
+	void copyRequestedFaces();
+	// Update maxRequestedFaces from requestedFacesBuffer if the copy is done
+	void readRequestedFaces();
+
+	Mode mode;
+	// Size of one face in the mesh buffer
+	int faceBytes;
 	int width, height, depth;
-	// The stage variable indicates whether meshing should be done for left, right, top, bottom, front, or back cube faces
+	int numBricks;
+	// The stage variable indicates whether meshing should be done for left, right, top, bottom, front, back, or all cube faces
 	GLint stageUniformLocation;
-	// Automata color scheme. An array of colors in RGB888 format
-	GLint colorSchemeUniformLocation;
-	// Output buffer. Vertices get directly written into this buffer.
+	GLint faceCapacityUniformLocation;
+	GLint useFaceMasksUniformLocation;
+	GLint greedyStageUniformLocation;
+	GLint greedyFaceCapacityUniformLocation;
+	GLint greedyUseFaceMasksUniformLocation;
+	GLint greedyFirstSideUniformLocation;
+	// Output buffer. Visible faces get appended to this buffer.
 	GLuint meshSSBO;
+	GLuint meshedCellSSBO;
+	// Number of faces meshSSBO can hold, limited by GL_MAX_SHADER_STORAGE_BLOCK_SIZE (maxMeshBytes)
+	int faceCapacity;
+	GLint64 maxMeshBytes;
+	// Automata color scheme last copied to paletteBuffer. An array of colors in RGB888 format
+	std::vector<GLuint> palette;
+	GLuint paletteBuffer;
+	// Indirect draw command, followed by the number of faces each stage tried to append in the current frame
+	GLuint drawCommandBuffer;
+	// Copy of the requested face counts of an earlier frame, read back by growMeshBuffer()
+	GLuint requestedFacesBuffer;
+	// Signaled when the copy in requestedFacesBuffer is done
+	GLsync meshFence;
+	// The last meshed frame still has to be copied to requestedFacesBuffer
+	bool requestedFacesPending;
+	// Most faces any stage tried to append in the last frame read back
+	GLuint maxRequestedFaces;
 	GLuint computeProgram;
+	// Meshing program of Mode::Greedy, one invocation per row of each slice of the grid. Only created in that mode.
+	GLuint greedyProgram;
+	// Indirect dispatch group counts followed by the list of bricks to mesh (same layout as in CellRulesShader)
+	GLuint brickListBuffer;
+	GLuint brickListProgram;
 };
 
 #endif // CELL_MESHING_SHADER_H
\ No newline at end of file
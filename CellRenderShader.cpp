@@ -1,38 +1,82 @@
 #include "CellRenderShader.h"
 
-CellRenderShader::CellRenderShader(int width, int height, int depth, GLuint cellMeshSSBO)
+CellRenderShader::CellRenderShader(int width, int height, int depth, CellMeshingShader& cellMeshingShader)
 {
 	this->width = width;
 	this->height = height;
 	this->depth = depth;
+	this->cellMeshingShader = &cellMeshingShader;
 	cellsSize = width * height * depth;
+	vertexPulling = cellMeshingShader.getMode() == CellMeshingShader::Mode::VertexPulling;
 
-	// We render the same mesh buffer generated by the CellMeshingShader to prevent expensive buffer copying operations.
-	glBindBuffer(GL_ARRAY_BUFFER, cellMeshSSBO);
-	// 4 bytes per component * 4 components per vertex * 6 vertices per face * 1 face per stage (also used in CellMeshingShader.cpp)
-	glBufferData(GL_ARRAY_BUFFER, 4 * 4 * 6 * static_cast<GLsizeiptr>(cellsSize), nullptr, GL_DYNAMIC_DRAW);
-
+	/* We render the same mesh buffer generated by the CellMeshingShader to prevent expensive buffer copying operations.
+	   CellMeshingShader allocates it and fills it with the visible faces only, 4 * 2 * 6 bytes per face. The vertex
+	   count is written by the meshing shader into the indirect draw command. */
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
 
-	// Vertices are in format (x: float32, y: float32, z: float32, color: uint32)
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(GLuint), 0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, 4 * sizeof(GLfloat), reinterpret_cast<void*>(3 * sizeof(GLfloat)));
+	// With vertex pulling, the vertex shader reads the face list and the cells itself, so the vertex array stays empty
+	if (!vertexPulling)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, cellMeshingShader.getMeshSSBO());
+		// Vertices are in format (position: uint32, data: uint32), see Vertex in CellMeshingShader.cpp
+		glEnableVertexAttribArray(0);
+		glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 2 * sizeof(GLuint), 0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, 2 * sizeof(GLuint), reinterpret_cast<void*>(sizeof(GLuint)));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 	glBindVertexArray(0);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	std::string vertexShaderSource = 
 R"(
 #version 430 core
 
+#define VERTEX_PULLING $$VERTEX_PULLING
+
 uniform mat4 mvpMatrix;
-uniform int stage;
 
-layout(location = 0) in vec3 position;
-layout(location = 1) in uint color;
+// Colors of the cell states in RGB888 format, 4 per uvec4
+layout(std140, binding = 0) uniform Palette
+{
+	uvec4 colors[$$PALETTE_SIZE / 4];
+} palette;
+
+#if VERTEX_PULLING
+// Cells the faces were built from, 8 bits each, packed 4 per uint (see CellMeshingShader::getMeshedCellSSBO)
+layout(std430, binding = 0) buffer State
+{
+	uint cells[];
+} state;
+
+// Visible faces, each the cell index times 8 plus the cube side
+layout(std430, binding = 1) buffer Mesh
+{
+	uint faces[];
+} mesh;
+
+const int WIDTH = $$WIDTH;
+const int HEIGHT = $$HEIGHT;
+
+// Corners of each side of a cube (left, right, bottom, top, back, front), in the order bottom left, bottom right, top
+// right, top left, like CUBE_FACES in CellMeshingShader.cpp
+const ivec3 CUBE_FACES[6][4] =
+{
+	{ ivec3(0, 0, 0), ivec3(0, 0, 1), ivec3(0, 1, 1), ivec3(0, 1, 0) },
+	{ ivec3(1, 0, 0), ivec3(1, 1, 0), ivec3(1, 1, 1), ivec3(1, 0, 1) },
+	{ ivec3(0, 0, 0), ivec3(1, 0, 0), ivec3(1, 0, 1), ivec3(0, 0, 1) },
+	{ ivec3(0, 1, 0), ivec3(0, 1, 1), ivec3(1, 1, 1), ivec3(1, 1, 0) },
+	{ ivec3(0, 0, 0), ivec3(0, 1, 0), ivec3(1, 1, 0), ivec3(1, 0, 0) },
+	{ ivec3(0, 0, 1), ivec3(1, 0, 1), ivec3(1, 1, 1), ivec3(0, 1, 1) }
+};
+// Corner of each of the 6 vertices of a face: two triangles, bottom left and top right
+const int FACE_CORNERS[6] = { 0, 1, 3, 2, 3, 1 };
+#else
+// Corner coordinates in 10 bits each
+layout(location = 0) in uint position;
+// Cell state in the low 8 bits, cube side above
+layout(location = 1) in uint data;
+#endif
 
 out vec3 vertexColor;
 
@@ -41,20 +85,25 @@ const float BRIGHTNESS[6] = { 0.8, 0.8, 0.6, 0.6, 1.0, 1.0 };
 
 void main()
 {
-	/* If the vertex data is null (not visible), render a null triangle with all vertices at (0, 0, 0).
-       1e38 is a large float value that we use as a flag for vertex data that shouldn't be rendered. */
-	if (position.x == 1e38)
-	{
-		gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
-		return;
-	}
-	
+#if VERTEX_PULLING
+	uint face = mesh.faces[gl_VertexID / 6];
+	int index = int(face >> 3);
+	uint side = face & 7;
+	uint cellState = (state.cells[index >> 2] >> (8 * (index & 3))) & 0xff;
+	ivec3 cell = ivec3(index % WIDTH, (index / WIDTH) % HEIGHT, index / (WIDTH * HEIGHT));
+	vec3 corner = vec3(cell + CUBE_FACES[side][FACE_CORNERS[gl_VertexID % 6]]);
+#else
+	uint cellState = data & 0xff;
+	uint side = data >> 8;
+	vec3 corner = vec3(position & 0x3ff, (position >> 10) & 0x3ff, position >> 20);
+#endif
+	uint color = palette.colors[cellState / 4][cellState % 4];
 	// Extract color components from RGB888 format integer
 	uint r = (color >> 16) & 0xff;
 	uint g = (color >> 8) & 0xff;
 	uint b = color & 0xff;
-    gl_Position = mvpMatrix * vec4(position, 1.0);
-	vertexColor = BRIGHTNESS[stage] * vec3
+    gl_Position = mvpMatrix * vec4(corner, 1.0);
+	vertexColor = BRIGHTNESS[side] * vec3
 	(
 		float(r) / 255.0,
 		float(g) / 255.0,
@@ -75,6 +124,21 @@ void main()
 }
 )";
 
+	stringReplace(vertexShaderSource, "$$PALETTE_SIZE", std::to_string(CellMeshingShader::PALETTE_SIZE));
+	stringReplace(vertexShaderSource, "$$VERTEX_PULLING", vertexPulling ? "1" : "0");
+	stringReplace(vertexShaderSource, "$$WIDTH", std::to_string(width));
+	stringReplace(vertexShaderSource, "$$HEIGHT", std::to_string(height));
+
+	// Both stages are cached as one program, keyed by both sources
+	std::string programSource = vertexShaderSource + fragmentShaderSource;
+	program = loadCachedProgram(programSource);
+	if (program != 0)
+	{
+		std::cout << "RenderShader loaded from the program cache." << std::endl << std::endl;
+		mvpMatrixUniformLocation = glGetUniformLocation(program, "mvpMatrix");
+		return;
+	}
+
 	const char* vertexShaderSourceStr = vertexShaderSource.c_str();
 	const char* fragmentShaderSourceStr = fragmentShaderSource.c_str();
 
@@ -95,13 +159,15 @@ void main()
 	program = glCreateProgram();
 	glAttachShader(program, vertexShader);
 	glAttachShader(program, fragmentShader);
+	if (isProgramCacheEnabled())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
+	saveCachedProgram(program, programSource);
 
 	glDeleteShader(vertexShader);
 	glDeleteShader(fragmentShader);
 
 	mvpMatrixUniformLocation = glGetUniformLocation(program, "mvpMatrix");
-	stageUniformLocation = glGetUniformLocation(program, "stage");
 }
 
 CellRenderShader::~CellRenderShader()
@@ -110,13 +176,23 @@ CellRenderShader::~CellRenderShader()
 	glDeleteProgram(program);
 }
 
-void CellRenderShader::renderMesh(glm::mat4 mvp, int stage)
+void CellRenderShader::renderMesh(glm::mat4 mvp)
 {
 	glUseProgram(program);
 	glUniformMatrix4fv(mvpMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(mvp));
-	glUniform1i(stageUniformLocation, stage);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, cellMeshingShader->getPaletteBuffer());
+	if (vertexPulling)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cellMeshingShader->getMeshedCellSSBO());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cellMeshingShader->getMeshSSBO());
+	}
 	glBindVertexArray(vao);
-	glDrawArrays(GL_TRIANGLES, 0, 6 * static_cast<GLsizei>(cellsSize));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cellMeshingShader->getDrawCommandBuffer());
+	glDrawArraysIndirect(GL_TRIANGLES, nullptr);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 	glBindVertexArray(0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
 	glUseProgram(0);
 }
@@ -9,21 +9,26 @@
 #include <iostream>
 
 #include "Util.h"
+#include "CellMeshingShader.h"
 
 class CellRenderShader
 {
 public:
-	CellRenderShader(int width, int height, int depth, GLuint cellMeshSSBO);
+	/* Renders the mesh built by cellMeshingShader, which must outlive this object. Its mesh buffer, draw command and
+	   palette are used directly, nothing is copied. */
+	CellRenderShader(int width, int height, int depth, CellMeshingShader& cellMeshingShader);
 	virtual ~CellRenderShader();
 
-	void renderMesh(glm::mat4 mvp, int stage);
+	void renderMesh(glm::mat4 mvp);
 private:
 	int width, height, depth;
 	int cellsSize;
 	GLint mvpMatrixUniformLocation;
-	GLint stageUniformLocation;
 	// Vertex array object for mesh vertex buffer
 	GLuint vao;
+	CellMeshingShader* cellMeshingShader;
+	// CellMeshingShader::Mode::VertexPulling, the vertex shader builds the vertices from the face list and the cells
+	bool vertexPulling;
 	GLuint program;
 };
 
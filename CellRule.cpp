@@ -0,0 +1,308 @@
+#include "CellRule.h"
+
+CellRule::CellRule()
+{
+	numStates = 0;
+	neighborhood = Neighborhood::Moore;
+	radius = 1;
+}
+
+CellRule CellRule::parse(std::string rule)
+{
+	rule.erase(std::remove_if(rule.begin(), rule.end(), isspace), rule.end());
+	for (auto it = rule.begin(); it != rule.end(); it++)
+	{
+		if (isalpha(*it))
+			*it = toupper(*it);
+	}
+
+	// Split into the B, S, states and neighborhood fields
+	std::vector<std::string> fields;
+	size_t start = 0;
+	while (true)
+	{
+		size_t end = rule.find('/', start);
+		fields.push_back(rule.substr(start, end == std::string::npos ? std::string::npos : end - start));
+		if (end == std::string::npos)
+			break;
+		start = end + 1;
+	}
+	CellRule invalidRule;
+	if (fields.size() < 2 || fields.size() > 4)
+		return invalidRule;
+
+	std::string bStr = fields[0];
+	std::string sStr = fields[1];
+	std::string nStr = fields.size() > 2 && fields[2].length() != 0 ? fields[2] : "2";
+	std::string mStr = fields.size() > 3 ? fields[3] : "M";
+	if (bStr.empty() || sStr.empty() || bStr[0] != 'B' || sStr[0] != 'S')
+		return invalidRule;
+
+	CellRule newRule;
+	try
+	{
+		if (!std::all_of(nStr.begin(), nStr.end(), isdigit))
+			return invalidRule;
+		newRule.numStates = std::stoi(nStr);
+	}
+	catch (const std::exception& ex)
+	{
+		return invalidRule;
+	}
+	if (newRule.numStates < 2 || newRule.numStates > 255)
+		return invalidRule;
+	if (!newRule.parseNeighborhood(mStr) || newRule.getMaxNeighbors() == 0)
+		return invalidRule;
+
+	newRule.born.assign(newRule.getMaxNeighbors() + 1, false);
+	newRule.stayAlive.assign(newRule.getMaxNeighbors() + 1, false);
+	if (!parseCounts(bStr.substr(1), newRule.born) || !parseCounts(sStr.substr(1), newRule.stayAlive))
+		return invalidRule;
+
+	return newRule;
+}
+
+bool CellRule::parseCounts(const std::string& str, std::vector<bool>& counts)
+{
+	size_t pos = -1;
+	do
+	{
+		size_t startPos = pos + 1;
+		pos = str.find(',', startPos);
+		if (pos == std::string::npos)
+			pos = str.length();
+
+		// Either a single count or a range of counts
+		std::string itemStr = str.substr(startPos, pos - startPos);
+		size_t dash = itemStr.find('-');
+		std::string firstStr = itemStr.substr(0, dash);
+		std::string lastStr = dash == std::string::npos ? firstStr : itemStr.substr(dash + 1);
+		if (!std::all_of(firstStr.begin(), firstStr.end(), isdigit) || !std::all_of(lastStr.begin(), lastStr.end(), isdigit))
+			return false;
+
+		int first = -1;
+		int last = -1;
+		try
+		{
+			first = std::stoi(firstStr);
+			last = std::stoi(lastStr);
+		}
+		catch (const std::exception& ex)
+		{
+			return false;
+		}
+		if (first < 0 || last < first || last >= static_cast<int>(counts.size()))
+			return false;
+
+		for (int i = first; i <= last; i++)
+			counts[i] = true;
+	} while (pos != str.length());
+
+	return true;
+}
+
+bool CellRule::parseNeighborhood(const std::string& str)
+{
+	if (str == "N" || str == "E")
+	{
+		neighborhood = str == "N" ? Neighborhood::VonNeumann : Neighborhood::Edges;
+		radius = 1;
+		return true;
+	}
+
+	if (str.empty() || (str[0] != 'M' && str[0] != 'K') || !std::all_of(str.begin() + 1, str.end(), isdigit))
+		return false;
+	if (str[0] == 'K')
+	{
+		// The number of weights decides the kernel size
+		int diameter = 0;
+		for (int r = 1; r <= MAX_KERNEL_RADIUS; r++)
+		{
+			if (str.length() - 1 == static_cast<size_t>((2 * r + 1) * (2 * r + 1) * (2 * r + 1)))
+			{
+				radius = r;
+				diameter = 2 * r + 1;
+			}
+		}
+		if (diameter == 0)
+			return false;
+		neighborhood = Neighborhood::Kernel;
+		weights.clear();
+		for (auto it = str.begin() + 1; it != str.end(); it++)
+			weights.push_back(*it - '0');
+		return true;
+	}
+
+	neighborhood = Neighborhood::Moore;
+	radius = 1;
+	if (str.length() > 1)
+	{
+		try
+		{
+			radius = std::stoi(str.substr(1));
+		}
+		catch (const std::exception& ex)
+		{
+			return false;
+		}
+	}
+	return radius >= 1 && radius <= MAX_RADIUS;
+}
+
+std::string CellRule::toString() const
+{
+	if (!isValid())
+		return "UndefinedRule";
+
+	std::string rule = "B " + countsToString(born) + " / S " + countsToString(stayAlive);
+	bool classic = neighborhood == Neighborhood::Moore && radius == 1;
+	if (numStates != 2 || !classic)
+		rule += " / " + std::to_string(numStates);
+	if (classic)
+		return rule;
+
+	if (neighborhood == Neighborhood::VonNeumann)
+		return rule + " / N";
+	if (neighborhood == Neighborhood::Edges)
+		return rule + " / E";
+	if (neighborhood == Neighborhood::Moore)
+		return rule + " / M" + std::to_string(radius);
+
+	// One group of digits per row of the kernel, and a wider gap between slices
+	size_t diameter = 2 * radius + 1;
+	rule += " / K";
+	for (size_t i = 0; i < weights.size(); i++)
+	{
+		if (i != 0 && i % (diameter * diameter) == 0)
+			rule += " ";
+		if (i % diameter == 0)
+			rule += " ";
+		rule += std::to_string(weights[i]);
+	}
+	return rule;
+}
+
+std::string CellRule::countsToString(const std::vector<bool>& counts)
+{
+	std::string str;
+	int n = static_cast<int>(counts.size());
+	for (int i = 0; i < n; i++)
+	{
+		if (!counts[i])
+			continue;
+		int last = i;
+		while (last + 1 < n && counts[last + 1])
+			last++;
+
+		if (!str.empty())
+			str += ",";
+		if (last - i >= 2)
+		{
+			str += std::to_string(i) + "-" + std::to_string(last);
+			i = last;
+		}
+		else
+		{
+			str += std::to_string(i);
+		}
+	}
+	return str;
+}
+
+bool CellRule::isValid() const
+{
+	return numStates != 0;
+}
+
+bool CellRule::isBorn(int n) const
+{
+	return n >= 0 && n < static_cast<int>(born.size()) && born[n];
+}
+
+bool CellRule::staysAlive(int n) const
+{
+	return n >= 0 && n < static_cast<int>(stayAlive.size()) && stayAlive[n];
+}
+
+int CellRule::getNumStates() const
+{
+	return numStates;
+}
+
+CellRule::Neighborhood CellRule::getNeighborhood() const
+{
+	return neighborhood;
+}
+
+int CellRule::getRadius() const
+{
+	return radius;
+}
+
+int CellRule::getWeight(int x, int y, int z) const
+{
+	if (std::abs(x) > radius || std::abs(y) > radius || std::abs(z) > radius)
+		return 0;
+
+	// Number of axes the offset moves along, 0 for the cell itself
+	int axes = int(x != 0) + int(y != 0) + int(z != 0);
+	switch (neighborhood)
+	{
+	case Neighborhood::Moore:
+		return axes == 0 ? 0 : 1;
+	case Neighborhood::VonNeumann:
+		return axes == 1 ? 1 : 0;
+	case Neighborhood::Edges:
+		return axes == 1 || axes == 2 ? 1 : 0;
+	default:
+		int diameter = 2 * radius + 1;
+		return weights[(x + radius) + (y + radius) * diameter + (z + radius) * diameter * diameter];
+	}
+}
+
+int CellRule::getMaxNeighbors() const
+{
+	switch (neighborhood)
+	{
+	case Neighborhood::VonNeumann:
+		return 6;
+	case Neighborhood::Edges:
+		return 18;
+	case Neighborhood::Kernel:
+		return std::accumulate(weights.begin(), weights.end(), 0);
+	default:
+		int diameter = 2 * radius + 1;
+		return diameter * diameter * diameter - 1;
+	}
+}
+
+bool CellRule::isSeparable() const
+{
+	return neighborhood == Neighborhood::Moore && radius > 1;
+}
+
+bool CellRule::hasSameNeighborhood(const CellRule& other) const
+{
+	return neighborhood == other.neighborhood && radius == other.radius && weights == other.weights;
+}
+
+CellTransition::CellTransition()
+{
+	born.assign(27, 0);
+	stayAlive.assign(27, 0);
+	dieState = 0;
+}
+
+CellTransition::CellTransition(const CellRule& rule)
+{
+	// At least the 0 to 26 neighbors of the 3x3x3 block, which UnboundedWorld and HashLife always count
+	int maxNeighbors = std::max(rule.getMaxNeighbors(), 26);
+	born.assign(maxNeighbors + 1, 0);
+	stayAlive.assign(maxNeighbors + 1, 0);
+	for (int i = 0; i <= maxNeighbors; i++)
+	{
+		born[i] = rule.isBorn(i) ? 1 : 0;
+		stayAlive[i] = rule.staysAlive(i) ? 1 : 0;
+	}
+	dieState = rule.getNumStates() > 2 ? static_cast<uint8_t>(rule.getNumStates() - 1) : 0;
+}
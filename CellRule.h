@@ -0,0 +1,115 @@
+#ifndef CELL_RULE_H
+#define CELL_RULE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+#include <numeric>
+#include <cstdlib>
+#include <stdexcept>
+
+/* A parsed cell rule. The format is:   B <numbers> / S <numbers> / <states> / <neighborhood>
+   where <numbers> is a comma separated list of neighbor counts or ranges of counts like 40-60. The <numbers> after B
+   determine the number of live neighbors a dead cell must have to be reborn, and the <numbers> after S the number of
+   live neighbors a living cell must have to survive. <states> is the number of states including the dead and alive
+   states (at least 2, see CellRulesShader::setRule for the refractory states). The neighborhood is one of:
+     M<radius>  the Moore neighborhood of the (2 radius + 1)^3 cells around a cell, radius 1 to MAX_RADIUS (M = M1)
+     N          the von Neumann neighborhood of the 6 cells sharing a face with the cell
+     E          the 18 cells sharing a face or an edge with the cell
+     K<weights> a custom kernel of 27 (3x3x3) or 125 (5x5x5) digits, x first, then y, then z. Each live cell adds its
+                weight (0 to 9) to the count, including the center cell if its weight isn't 0. Spaces may be used to
+                group the digits, for example K 000 010 000  010 101 010  000 010 000 is the von Neumann neighborhood.
+   The fields after S may be omitted for 2 states and M1, which is the classic 3x3x3 neighborhood with 0 to 26
+   neighbors. */
+class CellRule
+{
+public:
+	enum class Neighborhood
+	{
+		Moore,
+		VonNeumann,
+		Edges,
+		Kernel
+	};
+
+	static const int MAX_RADIUS = 5;
+	static const int MAX_KERNEL_RADIUS = 2;
+
+	// An invalid rule
+	CellRule();
+	// Parse a rule string in the format described above. Returns an invalid rule if the string is not a valid rule.
+	static CellRule parse(std::string rule);
+	// Convert the rule back to a string in the same format, with runs of 3 or more counts written as ranges
+	std::string toString() const;
+
+	bool isValid() const;
+	// Whether a dead cell with n live neighbors is born, n from 0 to getMaxNeighbors()
+	bool isBorn(int n) const;
+	// Whether a live cell with n live neighbors stays alive, n from 0 to getMaxNeighbors()
+	bool staysAlive(int n) const;
+	int getNumStates() const;
+	Neighborhood getNeighborhood() const;
+	// Largest offset of a neighbor along any axis: 1 for N and E, 1 or 2 for kernels
+	int getRadius() const;
+	// Weight of the neighbor at offset (x, y, z), each from -getRadius() to getRadius(). 0 outside the neighborhood.
+	int getWeight(int x, int y, int z) const;
+	// Highest possible neighbor count, the sum of all weights (the number of cells in the neighborhood minus the center)
+	int getMaxNeighbors() const;
+	// Moore neighborhoods above radius 1, which the engines count with separable box sums instead of cell by cell
+	bool isSeparable() const;
+	// Whether both rules count the same neighbors with the same weights, whatever their counts and states
+	bool hasSameNeighborhood(const CellRule& other) const;
+private:
+	// Parse a comma separated list of counts and ranges into flags. Returns false if the list is not valid.
+	static bool parseCounts(const std::string& str, std::vector<bool>& counts);
+	static std::string countsToString(const std::vector<bool>& counts);
+	// Parse the neighborhood field. Returns false if it is not valid.
+	bool parseNeighborhood(const std::string& str);
+
+	// Indexed by the number of live neighbors, getMaxNeighbors() + 1 entries
+	std::vector<bool> born;
+	std::vector<bool> stayAlive;
+	// 0 for an invalid rule
+	int numStates;
+	Neighborhood neighborhood;
+	int radius;
+	// (2 radius + 1)^3 weights of a kernel neighborhood, indexed like the cells (empty for the other neighborhoods)
+	std::vector<int> weights;
+};
+
+/* The next state of a cell by its state and neighbor count, from lookup tables of a CellRule. Every CPU engine
+   (CellRulesCPU, UnboundedWorld and HashLife) steps its cells with this, so they all follow the compute shaders:
+   live cells stay alive or die into the highest refractory state, refractory states count down to 2 and then skip the
+   alive state, and dead cells may be born. */
+class CellTransition
+{
+public:
+	// Nothing is born or stays alive, with 2 states and 0 to 26 neighbors
+	CellTransition();
+	CellTransition(const CellRule& rule);
+
+	// The state after state with n live neighbors, n from 0 to the getMaxNeighbors() of the rule (at least 26)
+	uint8_t apply(uint8_t state, int n) const
+	{
+		if (state == 1)
+			return stayAlive[n] ? 1 : dieState;
+		if (state > 2)
+			return static_cast<uint8_t>(state - 1);
+		if (state == 2)
+			return 0;
+		return born[n] ? 1 : 0;
+	}
+	bool isBorn(int n) const { return born[n] != 0; }
+	bool staysAlive(int n) const { return stayAlive[n] != 0; }
+	// The state a live cell dies into, 0 without refractory states
+	uint8_t getDieState() const { return dieState; }
+private:
+	// Indexed by the number of live neighbors, bytes rather than bools so lookups don't need bit masking
+	std::vector<uint8_t> born;
+	std::vector<uint8_t> stayAlive;
+	uint8_t dieState;
+};
+
+#endif // CELL_RULE_H
@@ -0,0 +1,677 @@
+#include "CellRulesCPU.h"
+#include "CellRulesShader.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit, used to visit only the cells of a bitplane word that need their 8-bit state updated
+static inline int lowestSetBit(uint64_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+/* Bit-sliced addition: a and b are numbers stored one bit per array element (least significant first), where each bit of
+   a 64-bit word belongs to a different cell. This adds 64 pairs of numbers at once with a ripple carry adder. */
+template <int A_BITS, int B_BITS, int OUT_BITS>
+static inline void addBitSliced(const uint64_t* a, const uint64_t* b, uint64_t* out)
+{
+	uint64_t carry = 0;
+	for (int i = 0; i < OUT_BITS; i++)
+	{
+		uint64_t x = i < A_BITS ? a[i] : 0;
+		uint64_t y = i < B_BITS ? b[i] : 0;
+		out[i] = x ^ y ^ carry;
+		carry = (x & y) | (carry & (x ^ y));
+	}
+}
+
+// Bit set for each cell whose bit-sliced 5-bit total equals value
+static inline uint64_t equalsBitSliced(const uint64_t* total, int value)
+{
+	uint64_t mask = ~static_cast<uint64_t>(0);
+	for (int i = 0; i < 5; i++)
+		mask &= (value >> i) & 1 ? total[i] : ~total[i];
+	return mask;
+}
+
+CellRulesCPU::CellRulesCPU(int width, int height, int depth, Mode mode, int numThreads)
+	: threadPool(numThreads)
+{
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	this->mode = mode;
+	cellsSize = width * height * depth;
+	radius = 1;
+	separable = false;
+
+	wordsPerRow = (width + 63) / 64;
+	lastWordMask = width % 64 == 0 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << (width % 64)) - 1;
+	const int brickSize = CellRulesShader::BRICK_SIZE;
+	bricksX = (width + brickSize - 1) / brickSize;
+	bricksY = (height + brickSize - 1) / brickSize;
+	bricksZ = (depth + brickSize - 1) / brickSize;
+	unboundedWorld = nullptr;
+	hashLife = nullptr;
+	windowX = -width / 2;
+	windowY = -height / 2;
+	windowZ = -depth / 2;
+	if (mode == Mode::Unbounded)
+	{
+		// The world shares the thread pool instead of starting one of its own
+		unboundedWorld = new UnboundedWorld(threadPool);
+	}
+	else if (mode == Mode::HashLife)
+	{
+		hashLife = new HashLife();
+	}
+	else if (mode == Mode::Dense)
+	{
+		cells[0].assign(cellsSize, 0);
+		cells[1].assign(cellsSize, 0);
+		brickFlags[0].assign(bricksX * bricksY * bricksZ, 0);
+		brickFlags[1].assign(bricksX * bricksY * bricksZ, 0);
+	}
+	else
+	{
+		size_t planeSize = static_cast<size_t>(wordsPerRow) * height * depth;
+		alivePlane[0].assign(planeSize, 0);
+		alivePlane[1].assign(planeSize, 0);
+		rowSums[0].assign(planeSize, 0);
+		rowSums[1].assign(planeSize, 0);
+		readyPlane.assign(planeSize, 0);
+		states.assign(cellsSize, 0);
+		std::vector<uint8_t> emptyCells(cellsSize, 0);
+		setCells(emptyCells.data());
+	}
+}
+
+CellRulesCPU::~CellRulesCPU()
+{
+	delete unboundedWorld;
+	delete hashLife;
+}
+
+void CellRulesCPU::setRule(const CellRule& rule)
+{
+	bool classic = rule.getNeighborhood() == CellRule::Neighborhood::Moore && rule.getRadius() == 1;
+	if (!classic && mode != Mode::Dense)
+		throw std::invalid_argument("CellRulesCPU: neighborhoods other than M1 need Dense mode");
+
+	transition = CellTransition(rule);
+	radius = rule.getRadius();
+	separable = rule.isSeparable();
+	neighborTaps.clear();
+	if (!classic && !separable)
+	{
+		for (int z = -radius; z <= radius; z++)
+			for (int y = -radius; y <= radius; y++)
+				for (int x = -radius; x <= radius; x++)
+					if (rule.getWeight(x, y, z) != 0)
+						neighborTaps.push_back({ x, y, z, rule.getWeight(x, y, z) });
+	}
+	if (unboundedWorld != nullptr)
+		unboundedWorld->setRule(rule);
+	if (hashLife != nullptr)
+		hashLife->setRule(rule);
+	if (separable)
+	{
+		boxSums[0].assign(cellsSize, 0);
+		boxSums[1].assign(cellsSize, 0);
+	}
+	else
+	{
+		boxSums[0].clear();
+		boxSums[1].clear();
+	}
+
+	bornTotals.clear();
+	stayAliveTotals.clear();
+	for (int i = 0; i < 27; i++)
+	{
+		if (transition.isBorn(i))
+			bornTotals.push_back(i);
+		if (transition.staysAlive(i))
+			stayAliveTotals.push_back(i + 1);
+	}
+}
+
+void CellRulesCPU::setCells(const uint8_t* cells)
+{
+	if (mode == Mode::Unbounded)
+	{
+		unboundedWorld->setCells(cells, windowX, windowY, windowZ, width, height, depth);
+		return;
+	}
+	if (mode == Mode::HashLife)
+	{
+		hashLife->setCells(cells, windowX, windowY, windowZ, width, height, depth);
+		return;
+	}
+
+	if (mode == Mode::Dense)
+	{
+		std::copy(cells, cells + cellsSize, this->cells[0].begin());
+
+		const int brickSize = CellRulesShader::BRICK_SIZE;
+		std::fill(brickFlags[0].begin(), brickFlags[0].end(), 0);
+		for (int i = 0; i < cellsSize; i++)
+		{
+			if (cells[i] != 0)
+			{
+				int x = i % width;
+				int y = (i / width) % height;
+				int z = i / (width * height);
+				brickFlags[0][x / brickSize + (y / brickSize) * bricksX + (z / brickSize) * bricksX * bricksY] = 1;
+			}
+		}
+		return;
+	}
+
+	std::fill(alivePlane[0].begin(), alivePlane[0].end(), 0);
+	std::fill(readyPlane.begin(), readyPlane.end(), 0);
+	for (int row = 0; row < height * depth; row++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			uint8_t state = cells[row * width + x];
+			uint64_t bit = static_cast<uint64_t>(1) << (x % 64);
+			size_t word = static_cast<size_t>(row) * wordsPerRow + x / 64;
+			if (state == 1)
+				alivePlane[0][word] |= bit;
+			else if (state == 0)
+				readyPlane[word] |= bit;
+			states[row * width + x] = state;
+		}
+	}
+}
+
+void CellRulesCPU::getCells(uint8_t* cells)
+{
+	if (mode == Mode::Unbounded)
+	{
+		unboundedWorld->getCells(cells, windowX, windowY, windowZ, width, height, depth);
+		return;
+	}
+	if (mode == Mode::HashLife)
+	{
+		hashLife->getCells(cells, windowX, windowY, windowZ, width, height, depth);
+		return;
+	}
+
+	if (mode == Mode::Dense)
+	{
+		std::copy(this->cells[0].begin(), this->cells[0].end(), cells);
+		return;
+	}
+
+	// The 8-bit state plane is always kept up to date, including for live cells
+	std::copy(states.begin(), states.end(), cells);
+}
+
+uint64_t CellRulesCPU::hashState()
+{
+	if (mode == Mode::Unbounded)
+		return unboundedWorld->hashState();
+	if (mode == Mode::HashLife)
+		return hashLife->getStateHash();
+	if (mode == Mode::Dense)
+		return hashCells(cells[0].data(), cellsSize, &threadPool);
+	return hashCells(states.data(), cellsSize, &threadPool);
+}
+
+void CellRulesCPU::clear()
+{
+	if (mode == Mode::Unbounded)
+	{
+		unboundedWorld->clear();
+		return;
+	}
+	if (mode == Mode::HashLife)
+	{
+		hashLife->clear();
+		return;
+	}
+
+	std::vector<uint8_t> emptyCells(cellsSize, 0);
+	setCells(emptyCells.data());
+}
+
+void CellRulesCPU::simulate(uint64_t generations)
+{
+	if (mode == Mode::HashLife)
+	{
+		hashLife->simulate(generations);
+		return;
+	}
+
+	for (uint64_t i = 0; i < generations; i++)
+		simulateStep();
+}
+
+void CellRulesCPU::simulateStep()
+{
+	if (mode == Mode::Unbounded)
+	{
+		unboundedWorld->simulate();
+		return;
+	}
+
+	if (mode == Mode::Bitplane)
+	{
+		// The second pass reads row sums from neighboring slabs, so the first pass must finish for the whole grid first
+		threadPool.parallelFor(depth, [this](int zBegin, int zEnd)
+		{
+			sumBitplaneRows(zBegin, zEnd);
+		});
+		threadPool.parallelFor(depth, [this](int zBegin, int zEnd)
+		{
+			simulateBitplaneSlab(zBegin, zEnd);
+		});
+		std::swap(alivePlane[0], alivePlane[1]);
+		return;
+	}
+
+	if (separable)
+	{
+		simulateSeparableStep();
+		return;
+	}
+
+	/* Same brick skipping as the GPU engine: a brick only needs simulating if it or one of its 26 neighbors has non-zero
+	   cells, or if the future buffer (which holds the state from 2 steps ago) still has non-zero cells in it. With B 0
+	   empty cells are born too, so every brick is simulated. */
+	const bool simulateAll = transition.isBorn(0);
+	activeBricks.clear();
+	for (int bz = 0; bz < bricksZ; bz++)
+	{
+		for (int by = 0; by < bricksY; by++)
+		{
+			for (int bx = 0; bx < bricksX; bx++)
+			{
+				int brick = bx + by * bricksX + bz * bricksX * bricksY;
+				bool needsSimulation = simulateAll || brickFlags[1][brick] != 0;
+				for (int z = -1; z <= 1 && !needsSimulation; z++)
+				{
+					for (int y = -1; y <= 1 && !needsSimulation; y++)
+					{
+						for (int x = -1; x <= 1 && !needsSimulation; x++)
+						{
+							int nx = (bx + x + bricksX) % bricksX;
+							int ny = (by + y + bricksY) % bricksY;
+							int nz = (bz + z + bricksZ) % bricksZ;
+							needsSimulation = brickFlags[0][nx + ny * bricksX + nz * bricksX * bricksY] != 0;
+						}
+					}
+				}
+				if (needsSimulation)
+					activeBricks.push_back(brick);
+			}
+		}
+	}
+
+	// Each thread gets a contiguous range of active bricks. Bricks only read the previous state, so they never interfere.
+	threadPool.parallelFor(static_cast<int>(activeBricks.size()), [this](int begin, int end)
+	{
+		const int brickSize = CellRulesShader::BRICK_SIZE;
+		for (int i = begin; i < end; i++)
+		{
+			int brick = activeBricks[i];
+			int x = (brick % bricksX) * brickSize;
+			int y = ((brick / bricksX) % bricksY) * brickSize;
+			int z = (brick / (bricksX * bricksY)) * brickSize;
+			bool nonZero = simulateBlock(x, std::min(x + brickSize, width), y, std::min(y + brickSize, height), z, std::min(z + brickSize, depth));
+			brickFlags[1][brick] = nonZero ? 1 : 0;
+		}
+	});
+	std::swap(cells[0], cells[1]);
+	std::swap(brickFlags[0], brickFlags[1]);
+}
+
+CellRulesCPU::Mode CellRulesCPU::getMode()
+{
+	return mode;
+}
+
+ThreadPool& CellRulesCPU::getThreadPool()
+{
+	return threadPool;
+}
+
+bool CellRulesCPU::simulateBlock(int xBegin, int xEnd, int yBegin, int yEnd, int zBegin, int zEnd)
+{
+	if (!neighborTaps.empty())
+		return simulateTapBlock(xBegin, xEnd, yBegin, yEnd, zBegin, zEnd);
+
+	const uint8_t* previousState = cells[0].data();
+	uint8_t* futureState = cells[1].data();
+	const int widthHeight = width * height;
+	bool nonZero = false;
+
+	for (int z = zBegin; z < zEnd; z++)
+	{
+		// Same toroidal wrap as the BACKWARD/FORWARD and DOWN/UP offsets in the compute shader
+		const int zs[3] = { z == 0 ? depth - 1 : z - 1, z, z == depth - 1 ? 0 : z + 1 };
+		for (int y = yBegin; y < yEnd; y++)
+		{
+			const int ys[3] = { y == 0 ? height - 1 : y - 1, y, y == height - 1 ? 0 : y + 1 };
+
+			// The 9 rows of the 3x3x3 neighborhood that pass through this row of cells
+			const uint8_t* rows[9];
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					rows[i * 3 + j] = previousState + ys[j] * width + zs[i] * widthHeight;
+
+			uint8_t* futureRow = futureState + y * width + z * widthHeight;
+			for (int x = xBegin; x < xEnd; x++)
+			{
+				// Same toroidal wrap as the LEFT/RIGHT offsets in the compute shader
+				const int xl = x == 0 ? width - 1 : x - 1;
+				const int xr = x == width - 1 ? 0 : x + 1;
+
+				int n = 0;
+				for (int i = 0; i < 9; i++)
+					n += int(rows[i][xl] == 1) + int(rows[i][x] == 1) + int(rows[i][xr] == 1);
+				// The center row (y, z) also counted the cell itself
+				const uint8_t state = rows[4][x];
+				n -= int(state == 1);
+
+				uint8_t newState = transition.apply(state, n);
+				futureRow[x] = newState;
+				nonZero = nonZero || newState != 0;
+			}
+		}
+	}
+
+	return nonZero;
+}
+
+void CellRulesCPU::sumBitplaneRows(int zBegin, int zEnd)
+{
+	const int last = wordsPerRow - 1;
+	// Bit position of the last cell of a row within the last word of the row
+	const int lastBit = (width - 1) % 64;
+
+	for (int row = zBegin * height; row < zEnd * height; row++)
+	{
+		const uint64_t* alive = alivePlane[0].data() + static_cast<size_t>(row) * wordsPerRow;
+		uint64_t* sum0 = rowSums[0].data() + static_cast<size_t>(row) * wordsPerRow;
+		uint64_t* sum1 = rowSums[1].data() + static_cast<size_t>(row) * wordsPerRow;
+		for (int i = 0; i < wordsPerRow; i++)
+		{
+			// Shift the row by one cell in each direction, carrying bits across words and wrapping around the row ends
+			uint64_t leftCarry = i == 0 ? (alive[last] >> lastBit) & 1 : alive[i - 1] >> 63;
+			uint64_t rightCarry = i == last ? (alive[0] & 1) << lastBit : alive[i + 1] << 63;
+			uint64_t mask = i == last ? lastWordMask : ~static_cast<uint64_t>(0);
+
+			uint64_t left = ((alive[i] << 1) | leftCarry) & mask;
+			uint64_t center = alive[i];
+			uint64_t right = (alive[i] >> 1) | rightCarry;
+
+			// Full adder: left + center + right = 0 to 3
+			sum0[i] = left ^ center ^ right;
+			sum1[i] = (left & center) | (right & (left ^ center));
+		}
+	}
+}
+
+void CellRulesCPU::simulateBitplaneSlab(int zBegin, int zEnd)
+{
+	const uint8_t dieState = transition.getDieState();
+
+	for (int z = zBegin; z < zEnd; z++)
+	{
+		const int zs[3] = { z == 0 ? depth - 1 : z - 1, z, z == depth - 1 ? 0 : z + 1 };
+		for (int y = 0; y < height; y++)
+		{
+			const int ys[3] = { y == 0 ? height - 1 : y - 1, y, y == height - 1 ? 0 : y + 1 };
+			size_t rows[9];
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					rows[i * 3 + j] = (static_cast<size_t>(zs[i]) * height + ys[j]) * wordsPerRow;
+
+			const size_t row = (static_cast<size_t>(z) * height + y) * wordsPerRow;
+			for (int i = 0; i < wordsPerRow; i++)
+			{
+				// Add up the 3 row sums of each z-slice (0 to 9), then the 3 slices (0 to 27)
+				uint64_t sliceTotals[3][4];
+				for (int j = 0; j < 3; j++)
+				{
+					const uint64_t a[2] = { rowSums[0][rows[j * 3] + i], rowSums[1][rows[j * 3] + i] };
+					const uint64_t b[2] = { rowSums[0][rows[j * 3 + 1] + i], rowSums[1][rows[j * 3 + 1] + i] };
+					const uint64_t c[2] = { rowSums[0][rows[j * 3 + 2] + i], rowSums[1][rows[j * 3 + 2] + i] };
+					uint64_t ab[3];
+					addBitSliced<2, 2, 3>(a, b, ab);
+					addBitSliced<3, 2, 4>(ab, c, sliceTotals[j]);
+				}
+				uint64_t partialTotal[5];
+				uint64_t total[5];
+				addBitSliced<4, 4, 5>(sliceTotals[0], sliceTotals[1], partialTotal);
+				addBitSliced<5, 4, 5>(partialTotal, sliceTotals[2], total);
+
+				uint64_t bornMask = 0;
+				for (int value : bornTotals)
+					bornMask |= equalsBitSliced(total, value);
+				uint64_t stayAliveMask = 0;
+				for (int value : stayAliveTotals)
+					stayAliveMask |= equalsBitSliced(total, value);
+
+				const uint64_t mask = i == wordsPerRow - 1 ? lastWordMask : ~static_cast<uint64_t>(0);
+				const uint64_t alive = alivePlane[0][row + i];
+				const uint64_t ready = readyPlane[row + i];
+				const uint64_t newAlive = ((alive & stayAliveMask) | (ready & bornMask)) & mask;
+				alivePlane[1][row + i] = newAlive;
+
+				// Update the 8-bit states, but only for cells which are not simply staying dead or staying alive
+				uint8_t* wordStates = states.data() + (static_cast<size_t>(z) * height + y) * width + i * 64;
+				uint64_t newReady = ready & ~newAlive;
+				uint64_t born = newAlive & ~alive;
+				uint64_t dying = alive & ~newAlive;
+				uint64_t refractory = ~alive & ~ready & mask;
+				while (born != 0)
+				{
+					wordStates[lowestSetBit(born)] = 1;
+					born &= born - 1;
+				}
+				while (dying != 0)
+				{
+					int bit = lowestSetBit(dying);
+					wordStates[bit] = dieState;
+					if (dieState == 0)
+						newReady |= static_cast<uint64_t>(1) << bit;
+					dying &= dying - 1;
+				}
+				while (refractory != 0)
+				{
+					int bit = lowestSetBit(refractory);
+					// Count down to state 2, then skip the alive state and go straight to dead
+					uint8_t state = wordStates[bit];
+					wordStates[bit] = state > 2 ? state - 1 : 0;
+					if (state <= 2)
+						newReady |= static_cast<uint64_t>(1) << bit;
+					refractory &= refractory - 1;
+				}
+				readyPlane[row + i] = newReady;
+			}
+		}
+	}
+}
+
+// Index i wrapped around into 0 to size - 1, also for windows wider than the grid
+static inline int wrapIndex(int i, int size)
+{
+	return ((i % size) + size) % size;
+}
+
+bool CellRulesCPU::simulateTapBlock(int xBegin, int xEnd, int yBegin, int yEnd, int zBegin, int zEnd)
+{
+	const uint8_t* previousState = cells[0].data();
+	uint8_t* futureState = cells[1].data();
+	const int widthHeight = width * height;
+	const int numTaps = static_cast<int>(neighborTaps.size());
+	const int kernelWidth = 2 * CellRule::MAX_KERNEL_RADIUS + 1;
+	// The row each neighbor is in, for the current row of cells
+	const uint8_t* tapRows[kernelWidth * kernelWidth * kernelWidth];
+	bool nonZero = false;
+
+	// Same toroidal wrap as the compute shader, indexed by x - xBegin and the x offset + MAX_KERNEL_RADIUS. Blocks are
+	// at most one brick wide.
+	const int brickSize = CellRulesShader::BRICK_SIZE;
+	int xs[brickSize][kernelWidth];
+	for (int x = xBegin; x < xEnd; x++)
+		for (int i = 0; i < kernelWidth; i++)
+			xs[x - xBegin][i] = wrapIndex(x + i - CellRule::MAX_KERNEL_RADIUS, width);
+
+	for (int z = zBegin; z < zEnd; z++)
+	{
+		for (int y = yBegin; y < yEnd; y++)
+		{
+			for (int i = 0; i < numTaps; i++)
+			{
+				const NeighborTap& tap = neighborTaps[i];
+				tapRows[i] = previousState + wrapIndex(y + tap.y, height) * width + wrapIndex(z + tap.z, depth) * widthHeight;
+			}
+
+			const uint8_t* row = previousState + y * width + z * widthHeight;
+			uint8_t* futureRow = futureState + y * width + z * widthHeight;
+			for (int x = xBegin; x < xEnd; x++)
+			{
+				const int* wrappedX = xs[x - xBegin] + CellRule::MAX_KERNEL_RADIUS;
+				int n = 0;
+				for (int i = 0; i < numTaps; i++)
+					n += neighborTaps[i].weight * int(tapRows[i][wrappedX[neighborTaps[i].x]] == 1);
+
+				uint8_t newState = transition.apply(row[x], n);
+				futureRow[x] = newState;
+				nonZero = nonZero || newState != 0;
+			}
+		}
+	}
+
+	return nonZero;
+}
+
+void CellRulesCPU::simulateSeparableStep()
+{
+	// Each pass reads the whole output of the previous one, so a pass must finish for the whole grid first
+	threadPool.parallelFor(depth, [this](int zBegin, int zEnd)
+	{
+		sumSeparableRows(zBegin, zEnd);
+	});
+	threadPool.parallelFor(depth, [this](int zBegin, int zEnd)
+	{
+		sumSeparableColumns(zBegin, zEnd);
+	});
+	// Threads get whole rows of bricks, so every brick flag is written by one thread
+	threadPool.parallelFor(bricksY, [this](int begin, int end)
+	{
+		const int brickSize = CellRulesShader::BRICK_SIZE;
+		simulateSeparableRows(begin * brickSize, std::min(end * brickSize, height));
+	});
+	std::swap(cells[0], cells[1]);
+	std::swap(brickFlags[0], brickFlags[1]);
+}
+
+void CellRulesCPU::sumSeparableRows(int zBegin, int zEnd)
+{
+	for (int row = zBegin * height; row < zEnd * height; row++)
+	{
+		const uint8_t* cellRow = cells[0].data() + static_cast<size_t>(row) * width;
+		uint8_t* sumRow = boxSums[0].data() + static_cast<size_t>(row) * width;
+
+		// Running sum of the window from x - radius to x + radius, wrapping around the row ends
+		int sum = 0;
+		for (int i = -radius; i <= radius; i++)
+			sum += int(cellRow[wrapIndex(i, width)] == 1);
+		int enter = wrapIndex(radius + 1, width);
+		int leave = wrapIndex(-radius, width);
+		for (int x = 0; x < width; x++)
+		{
+			sumRow[x] = static_cast<uint8_t>(sum);
+			sum += int(cellRow[enter] == 1) - int(cellRow[leave] == 1);
+			enter = enter + 1 == width ? 0 : enter + 1;
+			leave = leave + 1 == width ? 0 : leave + 1;
+		}
+	}
+}
+
+void CellRulesCPU::sumSeparableColumns(int zBegin, int zEnd)
+{
+	// Slide a window of rows along y, a whole row at a time
+	std::vector<int> sums(width);
+	for (int z = zBegin; z < zEnd; z++)
+	{
+		const uint8_t* rowSums = boxSums[0].data() + static_cast<size_t>(z) * width * height;
+		uint8_t* columnSums = boxSums[1].data() + static_cast<size_t>(z) * width * height;
+
+		std::fill(sums.begin(), sums.end(), 0);
+		for (int i = -radius; i <= radius; i++)
+		{
+			const uint8_t* row = rowSums + static_cast<size_t>(wrapIndex(i, height)) * width;
+			for (int x = 0; x < width; x++)
+				sums[x] += row[x];
+		}
+		for (int y = 0; y < height; y++)
+		{
+			const uint8_t* enter = rowSums + static_cast<size_t>(wrapIndex(y + radius + 1, height)) * width;
+			const uint8_t* leave = rowSums + static_cast<size_t>(wrapIndex(y - radius, height)) * width;
+			uint8_t* out = columnSums + static_cast<size_t>(y) * width;
+			for (int x = 0; x < width; x++)
+			{
+				out[x] = static_cast<uint8_t>(sums[x]);
+				sums[x] += enter[x] - leave[x];
+			}
+		}
+	}
+}
+
+void CellRulesCPU::simulateSeparableRows(int yBegin, int yEnd)
+{
+	const int brickSize = CellRulesShader::BRICK_SIZE;
+	const int widthHeight = width * height;
+	for (int bz = 0; bz < bricksZ; bz++)
+	{
+		for (int by = yBegin / brickSize; by <= (yEnd - 1) / brickSize; by++)
+			std::fill_n(brickFlags[1].begin() + by * bricksX + bz * bricksX * bricksY, bricksX, 0);
+	}
+
+	// Slide a window of slices along z for each row
+	std::vector<int> sums(width);
+	for (int y = yBegin; y < yEnd; y++)
+	{
+		std::fill(sums.begin(), sums.end(), 0);
+		for (int i = -radius; i <= radius; i++)
+		{
+			const uint8_t* row = boxSums[1].data() + static_cast<size_t>(wrapIndex(i, depth)) * widthHeight + y * width;
+			for (int x = 0; x < width; x++)
+				sums[x] += row[x];
+		}
+		for (int z = 0; z < depth; z++)
+		{
+			const uint8_t* previousRow = cells[0].data() + static_cast<size_t>(z) * widthHeight + y * width;
+			uint8_t* futureRow = cells[1].data() + static_cast<size_t>(z) * widthHeight + y * width;
+			uint8_t* brickRow = brickFlags[1].data() + (y / brickSize) * bricksX + (z / brickSize) * bricksX * bricksY;
+			for (int x = 0; x < width; x++)
+			{
+				// The box around the cell also counted the cell itself
+				const uint8_t state = previousRow[x];
+				uint8_t newState = transition.apply(state, sums[x] - int(state == 1));
+				futureRow[x] = newState;
+				if (newState != 0)
+					brickRow[x / brickSize] = 1;
+			}
+
+			const uint8_t* enter = boxSums[1].data() + static_cast<size_t>(wrapIndex(z + radius + 1, depth)) * widthHeight + y * width;
+			const uint8_t* leave = boxSums[1].data() + static_cast<size_t>(wrapIndex(z - radius, depth)) * widthHeight + y * width;
+			for (int x = 0; x < width; x++)
+				sums[x] += enter[x] - leave[x];
+		}
+	}
+}
@@ -0,0 +1,135 @@
+#ifndef CELL_RULES_CPU_H
+#define CELL_RULES_CPU_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+#include "UnboundedWorld.h"
+#include "HashLife.h"
+#include "CellRule.h"
+#include "StateHistory.h"
+
+/* CPU implementation of the cell rules compute shader in CellRulesShader.cpp. It produces bit-identical results to the
+   shader (same neighbor counting, same refractory cycle, same toroidal wrap) but needs no OpenGL context, so it can run
+   on machines without a GPU. Each step is split into chunks which are simulated in parallel by a thread pool. */
+class CellRulesCPU
+{
+public:
+	/* Dense stores one 8-bit state per cell, exactly like the cell SSBOs.
+	   Bitplane stores whether each cell is alive as 1 bit per cell (64 cells per word along x) and counts neighbors for
+	   64 cells at a time with bit-sliced adders. Refractory states are kept in a separate 8-bit plane which is only
+	   touched for cells that are changing state or counting down.
+	   Unbounded simulates an infinite grid (see UnboundedWorld) instead of wrapping around the edges. The width x height x
+	   depth grid is then a window centered on the origin of the infinite grid, used by setCells and getCells.
+	   HashLife also simulates an infinite grid through the same window, but with the memoized octree in HashLife, so
+	   simulate() can jump over many generations at once. */
+	enum class Mode
+	{
+		Dense,
+		Bitplane,
+		Unbounded,
+		HashLife
+	};
+
+	// numThreads = 0 uses one thread per hardware core
+	CellRulesCPU(int width, int height, int depth, Mode mode = Mode::Dense, int numThreads = 0);
+	virtual ~CellRulesCPU();
+
+	/* Neighborhoods other than the radius 1 Moore neighborhood are only supported in Dense mode, where larger Moore
+	   neighborhoods are counted with separable box sums like in the GPU engine. Throws std::invalid_argument for them
+	   in the other modes. */
+	void setRule(const CellRule& rule);
+
+	// Copy cells into the current state
+	void setCells(const uint8_t* cells);
+	// Copy the current state into cells
+	void getCells(uint8_t* cells);
+	/* hashCells() of the current state, straight from the cells of the engine without copying them. Dense and Bitplane
+	   give the same hash as the GPU engine for the same cells, while Unbounded and HashLife hash their whole infinite
+	   grid (see UnboundedWorld::hashState() and HashLife::getStateHash()), so cells outside the window count too. */
+	uint64_t hashState();
+	// Set every cell to 0
+	void clear();
+	// Simulate the given number of timesteps (HashLife mode does this in O(log(generations)) jumps)
+	void simulate(uint64_t generations = 1);
+	Mode getMode();
+	ThreadPool& getThreadPool();
+private:
+	void simulateStep();
+	// Simulate a box of cells and return whether any of the new cell states are non-zero
+	bool simulateBlock(int xBegin, int xEnd, int yBegin, int yEnd, int zBegin, int zEnd);
+	// simulateBlock for the neighborhoods in neighborTaps
+	bool simulateTapBlock(int xBegin, int xEnd, int yBegin, int yEnd, int zBegin, int zEnd);
+	// Bitplane mode is done in two passes: sum each cell with its left and right neighbor, then add up the 9 row sums
+	void sumBitplaneRows(int zBegin, int zEnd);
+	void simulateBitplaneSlab(int zBegin, int zEnd);
+	/* Dense mode with a radius above 1 counts neighbors in three passes of running sums along x, then y, then z, so the
+	   cost per cell doesn't depend on the radius. Every cell is simulated, there is no brick skipping. */
+	void simulateSeparableStep();
+	// Sums of the live cells within the radius along x, written to boxSums[0]
+	void sumSeparableRows(int zBegin, int zEnd);
+	// Sums of boxSums[0] within the radius along y, written to boxSums[1]
+	void sumSeparableColumns(int zBegin, int zEnd);
+	// Sum boxSums[1] along z and simulate the rows y = yBegin to yEnd - 1 of every slice
+	void simulateSeparableRows(int yBegin, int yEnd);
+
+	int width, height, depth;
+	int cellsSize;
+	Mode mode;
+	// Next states by the number of live neighbors (0 to CellRule::getMaxNeighbors())
+	CellTransition transition;
+	int radius;
+	// Moore neighborhoods above radius 1 use the separable passes
+	bool separable;
+	// A neighbor with a non-zero weight, at offset (x, y, z) from the cell
+	struct NeighborTap
+	{
+		int x, y, z;
+		int weight;
+	};
+	/* The neighbors of the N, E and kernel neighborhoods. Only these are read, so cells outside of the neighborhood or
+	   with a weight of 0 cost nothing. Empty for Moore neighborhoods. */
+	std::vector<NeighborTap> neighborTaps;
+	// Current and future state, swapped after each step just like the cell SSBOs (dense mode only)
+	std::vector<uint8_t> cells[2];
+	/* Dense mode skips empty bricks of CellRulesShader::BRICK_SIZE^3 cells, just like the GPU engine. Rules with B 0
+	   bring empty bricks to life, so both simulate every brick for them. */
+	int bricksX, bricksY, bricksZ;
+	// Whether each brick of the matching cell buffer has any non-zero cells
+	std::vector<uint8_t> brickFlags[2];
+	std::vector<int> activeBricks;
+	// Box sums of the separable passes, one byte per cell (at most 11 and 121 cells for radius 5)
+	std::vector<uint8_t> boxSums[2];
+
+	// *** BITPLANE MODE ***
+	int wordsPerRow;
+	// Mask of the valid bits in the last word of each row (rows are padded to a multiple of 64 cells)
+	uint64_t lastWordMask;
+	// Current and future alive planes (bit set where state == 1), swapped after each step
+	std::vector<uint64_t> alivePlane[2];
+	// Bit set where state == 0, these are the only cells which can be born
+	std::vector<uint64_t> readyPlane;
+	// 2-bit sums of each cell's alive bit with its left and right neighbors, stored as 2 bit-slices
+	std::vector<uint64_t> rowSums[2];
+	// Full cell state, only read and written for cells which are born, die or are counting down a refractory state
+	std::vector<uint8_t> states;
+	/* Neighbor counts for which a cell is born or stays alive. The bitplane counter adds up all 27 cells of the
+	   3x3x3 block (0 to 27), so a live cell with n neighbors shows up as n + 1. */
+	std::vector<int> bornTotals;
+	std::vector<int> stayAliveTotals;
+
+	// *** UNBOUNDED MODE ***
+	UnboundedWorld* unboundedWorld;
+	// Lowest corner of the window in the infinite grid
+	int windowX, windowY, windowZ;
+
+	// *** HASHLIFE MODE ***
+	HashLife* hashLife;
+
+	ThreadPool threadPool;
+};
+
+#endif // CELL_RULES_CPU_H
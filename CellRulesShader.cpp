@@ -1,167 +1,373 @@
 #include "CellRulesShader.h"
 
-CellRulesShader::CellRulesShader(int width, int height, int depth, std::string rule)
+/* GLSL condition on the neighbor count n which is true for the counts of the B (born) or S (stay alive) rules. Runs of
+   counts are written as ranges, so rules with large neighborhoods stay short. */
+static std::string countCondition(const CellRule& rule, bool born)
 {
-	ruleFlags = 0;
+	std::string condition;
+	int maxNeighbors = rule.getMaxNeighbors();
+	for (int i = 0; i <= maxNeighbors; i++)
+	{
+		if (!(born ? rule.isBorn(i) : rule.staysAlive(i)))
+			continue;
+		int last = i;
+		while (last < maxNeighbors && (born ? rule.isBorn(last + 1) : rule.staysAlive(last + 1)))
+			last++;
+
+		if (!condition.empty())
+			condition += " || ";
+		if (last == i)
+			condition += "n == " + std::to_string(i);
+		else
+			condition += "(n >= " + std::to_string(i) + " && n <= " + std::to_string(last) + ")";
+		i = last;
+	}
+	return condition.empty() ? "false" : condition;
+}
+
+CellRulesShader::CellRulesShader(int width, int height, int depth, std::string rule, Engine engine, bool faceMasks)
+{
+	this->engine = engine;
+	this->faceMasks = faceMasks && engine == Engine::GPU;
 	this->width = width;
 	this->height = height;
 	this->depth = depth;
 	cellsSize = width * height * depth;
+	// GPU buffers hold whole uints, so round the byte size up to a multiple of 4
+	paddedCellsSize = (cellsSize + 3) / 4 * 4;
+	// Bricks on the far edges are partially outside of the grid if a dimension is not a multiple of BRICK_SIZE
+	bricksX = (width + BRICK_SIZE - 1) / BRICK_SIZE;
+	bricksY = (height + BRICK_SIZE - 1) / BRICK_SIZE;
+	bricksZ = (depth + BRICK_SIZE - 1) / BRICK_SIZE;
+	numBricks = bricksX * bricksY * bricksZ;
 	cells = nullptr;
+	// The rules compute shader simulates one packed word of 4 cells per invocation, so rows must be whole words
+	if (engine == Engine::GPU && width % 4 != 0)
+		throw std::invalid_argument("CellRulesShader: GPU engine width must be a multiple of 4");
 	cellSSBO[0] = 0;
 	cellSSBO[1] = 0;
+	brickFlagSSBO[0] = 0;
+	brickFlagSSBO[1] = 0;
+	brickListBuffer = 0;
 	computeProgram = 0;
-	setRule(rule);
+	brickListProgram = 0;
+	seedProgram = 0;
+	separablePrograms[0] = 0;
+	separablePrograms[1] = 0;
+	separablePrograms[2] = 0;
+	boxSumSSBO[0] = 0;
+	boxSumSSBO[1] = 0;
+	faceMaskSSBO = 0;
+	faceCountSSBO = 0;
+	faceMasksValid = false;
+	tileSize = 0;
+	useRuleTable = false;
+	ruleTableSSBO = 0;
+	pendingComputeProgram = 0;
+	pendingSeparablePrograms[0] = 0;
+	pendingSeparablePrograms[1] = 0;
+	pendingSeparablePrograms[2] = 0;
+	trackStates = false;
+	stateHashSSBO = 0;
+	stateHashData = nullptr;
+	cpuRules = nullptr;
+	if (engine == Engine::CPU)
+		cpuRules = new CellRulesCPU(width, height, depth, CellRulesCPU::Mode::Dense);
+	else if (engine == Engine::CPUBitplane)
+		cpuRules = new CellRulesCPU(width, height, depth, CellRulesCPU::Mode::Bitplane);
+	else if (engine == Engine::CPUUnbounded)
+		cpuRules = new CellRulesCPU(width, height, depth, CellRulesCPU::Mode::Unbounded);
+	else if (engine == Engine::CPUHashLife)
+		cpuRules = new CellRulesCPU(width, height, depth, CellRulesCPU::Mode::HashLife);
+	cellSSBOOutdated = true;
+	generation = 0;
+
+	// The cells and their buffers are allocated once here and kept through every rule change
+	cells = new uint8_t[paddedCellsSize];
+	std::fill(cells, cells + paddedCellsSize, 0);
+	if (engine == Engine::GPU)
+	{
+		// Let the driver compile the shaders of new rules on its own threads, see setRule()
+		if (GLEW_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xffffffff);
+		createGPUResources();
+	}
+	try
+	{
+		setRule(rule);
+	}
+	catch (const std::invalid_argument&)
+	{
+		cleanup();
+		delete cpuRules;
+		throw;
+	}
 }
 
 CellRulesShader::~CellRulesShader()
 {
 	cleanup();
+	delete cpuRules;
 }
 
 void CellRulesShader::setRule(std::string rule)
 {
-	ruleFlags = 0;
-
-	// *** BEGIN PARSE RULE STRING ***
+	CellRule newRule = CellRule::parse(rule);
+	if (!newRule.isValid())
+		return;
+	bool classic = newRule.getNeighborhood() == CellRule::Neighborhood::Moore && newRule.getRadius() == 1;
+	if (!classic && engine != Engine::GPU && engine != Engine::CPU)
+		throw std::invalid_argument("CellRulesShader: only the GPU and CPU engines support neighborhoods other than M1");
 
-	rule.erase(std::remove_if(rule.begin(), rule.end(), isspace), rule.end());
-	for (auto it = rule.begin(); it != rule.end(); it++)
+	if (cpuRules != nullptr)
 	{
-		if (isalpha(*it))
-			*it = toupper(*it);
+		// The CPU engines switch right away and keep their cells
+		cpuRules->setRule(newRule);
+		cellRule = newRule;
+		resetStateHistory();
+		return;
 	}
 
-	size_t i0 = rule.find('/', 0);
-	size_t i1 = rule.find('/', i0 + 1);
-	if (i0 == std::string::npos)
-		return;
+	// A rule whose shaders are still compiling is replaced by this one
+	discardPendingRule();
 
-	std::string bStr = rule.substr(0, i0);
-	std::string sStr;
-	std::string nStr;
-	if (i1 == std::string::npos)
-	{
-		sStr = rule.substr(i0 + 1);
-		nStr = "2";
-	} 
-	else
+	// The rule table shaders only depend on the neighborhood, so a new table is all it takes
+	if (useRuleTable && cellRule.isValid() && newRule.hasSameNeighborhood(cellRule))
 	{
-		sStr = rule.substr(i0 + 1, i1 - (i0 + 1));
-		nStr = rule.substr(i1 + 1);
-		if (nStr.length() == 0)
-			nStr = "2";
+		uploadRuleTable(newRule);
+		cellRule = newRule;
+		resetStateHistory();
+		return;
 	}
 
-	if (bStr[0] != 'B' || sStr[0] != 'S')
-		return;
+	// The old shaders keep simulating until the new ones are ready, see simulate(). The first rule has nothing to fall back on.
+	startPendingRule(newRule);
+	if (!cellRule.isValid())
+		finishRuleChange();
+}
 
-	bStr.erase(0, 1);
-	sStr.erase(0, 1);
+void CellRulesShader::createGPUResources()
+{
+	// *** BEGIN OPENGL BUFFER/SHADER SETUP ***
 
-	uint64_t newRuleFlags = 0;
-	size_t bStrPos = -1;
-	do 
+	/* We generate 2 buffers, one for the previous state of the cellular automaton, and one for the future state. 
+	   The compute shader will read data from the previous state buffer and write data to the future state buffer.
+	   These buffers are designed to be swapped before each simulation so that buffer data never has to be copied.
+	   They are allocated once and keep the cells through rule changes.
+	   Each cell is 1 byte, so in the shader every uint holds 4 consecutive cells along the x axis. */
+	glGenBuffers(2, cellSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSSBO[0]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(paddedCellsSize), cells, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSSBO[1]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(paddedCellsSize), cells, GL_DYNAMIC_DRAW);
+
+	/* Each cell buffer has a matching brick flag buffer (1 uint per brick, swapped along with the cell buffers) which
+	   records which bricks contain any non-zero cells. Both start empty, just like the cell buffers. */
+	std::vector<GLuint> emptyBrickFlags(numBricks, 0);
+	glGenBuffers(2, brickFlagSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickFlagSSBO[0]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * static_cast<GLsizeiptr>(numBricks), emptyBrickFlags.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickFlagSSBO[1]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * static_cast<GLsizeiptr>(numBricks), emptyBrickFlags.data(), GL_DYNAMIC_DRAW);
+
+	// The brick list is 4 uints of header (indirect dispatch group counts and the number of bricks) followed by the brick indices
+	glGenBuffers(1, &brickListBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickListBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (4 + static_cast<GLsizeiptr>(numBricks)), nullptr, GL_DYNAMIC_DRAW);
+
+	/* Face masks and face counts are only written for simulated bricks. Skipped bricks are empty in the input, and were
+	   also empty in the input of the step that last wrote them, so their masks and counts are always 0. */
+	if (faceMasks)
 	{
-		size_t startPos = bStrPos + 1;
-		bStrPos = bStr.find(',', startPos);
-		if (bStrPos == std::string::npos)
-			bStrPos = bStr.length();
+		glGenBuffers(1, &faceMaskSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, faceMaskSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(paddedCellsSize), cells, GL_DYNAMIC_DRAW);
+		glGenBuffers(1, &faceCountSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, faceCountSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * static_cast<GLsizeiptr>(numBricks), emptyBrickFlags.data(), GL_DYNAMIC_DRAW);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-		std::string digitsStr = bStr.substr(startPos, bStrPos - startPos);
-		if (!std::all_of(digitsStr.begin(), digitsStr.end(), isdigit))
-			return;
+	/* The brick list shader decides which bricks need to be simulated. A brick is skipped when it and its 26 neighbor
+	   bricks are empty in the previous state, because all of its cells would stay 0. The brick must also be empty in the
+	   future state buffer, which still holds the state from 2 steps ago and would otherwise keep stale cells. Rules with
+	   B 0 give birth to cells with no live neighbors, so for them simulateAll lists every brick. It is a uniform rather
+	   than a constant since a rule table changes the rule without rebuilding the shaders. */
+	std::string brickListShaderSource =
+R"(
+#version 430 core
 
-		int ruleNumber = -1;
-		try
-		{
-			ruleNumber = std::stoi(digitsStr);
-		}
-		catch (const std::invalid_argument& ex)
-		{
-			return;
-		}
-		if (ruleNumber < 0 || ruleNumber > 26)
-			return;
+layout(local_size_x = 64) in;
 
-		newRuleFlags |= (uint64_t) 1 << ruleNumber;
-	} while (bStrPos != bStr.length());
+layout(std430, binding = 0) buffer PreviousBrickFlags
+{
+	uint flags[];
+} previousBrickFlags;
 
-	size_t sStrPos = -1;
-	do
-	{
-		size_t startPos = sStrPos + 1;
-		sStrPos = sStr.find(',', startPos);
-		if (sStrPos == std::string::npos)
-			sStrPos = sStr.length();
+layout(std430, binding = 1) buffer FutureBrickFlags
+{
+	uint flags[];
+} futureBrickFlags;
 
-		std::string digitsStr = sStr.substr(startPos, sStrPos - startPos);
-		if (!std::all_of(digitsStr.begin(), digitsStr.end(), isdigit))
-			return;
+layout(std430, binding = 2) buffer BrickList
+{
+	uint numGroupsX;
+	uint numGroupsY;
+	uint numGroupsZ;
+	uint count;
+	uint bricks[];
+} brickList;
+
+layout(location = 0) uniform bool simulateAll;
+
+const int BRICKS_X = $$BRICKS_X;
+const int BRICKS_Y = $$BRICKS_Y;
+const int BRICKS_Z = $$BRICKS_Z;
+const int NUM_BRICKS = BRICKS_X * BRICKS_Y * BRICKS_Z;
+// Work groups are laid out in rows of this many groups, since the number of groups in one dimension is limited
+const uint MAX_GROUPS_X = 1024;
+
+void main()
+{
+	int brick = int(gl_GlobalInvocationID.x);
+	if (brick >= NUM_BRICKS)
+		return;
 
-		int ruleNumber = -1;
-		try
-		{
-			ruleNumber = std::stoi(digitsStr);
-		}
-		catch (const std::invalid_argument& ex)
+	ivec3 brickPosition = ivec3(brick % BRICKS_X, (brick / BRICKS_X) % BRICKS_Y, brick / (BRICKS_X * BRICKS_Y));
+	bool needsSimulation = simulateAll || futureBrickFlags.flags[brick] != 0;
+	for (int z = -1; z <= 1; z++)
+	{
+		for (int y = -1; y <= 1; y++)
 		{
-			return;
+			for (int x = -1; x <= 1; x++)
+			{
+				// Neighbor bricks wrap around the grid just like neighbor cells
+				ivec3 neighbor = (brickPosition + ivec3(x, y, z) + ivec3(BRICKS_X, BRICKS_Y, BRICKS_Z)) % ivec3(BRICKS_X, BRICKS_Y, BRICKS_Z);
+				needsSimulation = needsSimulation || previousBrickFlags.flags[neighbor.x + neighbor.y * BRICKS_X + neighbor.z * BRICKS_X * BRICKS_Y] != 0;
+			}
 		}
-		if (ruleNumber < 0 || ruleNumber > 26)
-			return;
-
-		newRuleFlags |= (uint64_t) 1 << (ruleNumber + 27);
-	} while (sStrPos != sStr.length());
+	}
 
-	if (!std::all_of(nStr.begin(), nStr.end(), isdigit))
-		return;
-	int numStates = 0;
-	try
+	if (needsSimulation)
 	{
-		numStates = std::stoi(nStr);
-	}
-	catch (const std::invalid_argument& ex)
-	{
-		return;
+		uint i = atomicAdd(brickList.count, 1);
+		brickList.bricks[i] = uint(brick);
+		atomicMax(brickList.numGroupsX, min(i + 1, MAX_GROUPS_X));
+		atomicMax(brickList.numGroupsY, i / MAX_GROUPS_X + 1);
 	}
+}
+)";
+	stringReplace(brickListShaderSource, "$$BRICKS_X", std::to_string(bricksX));
+	stringReplace(brickListShaderSource, "$$BRICKS_Y", std::to_string(bricksY));
+	stringReplace(brickListShaderSource, "$$BRICKS_Z", std::to_string(bricksZ));
+	brickListProgram = createComputeProgram(brickListShaderSource, "CellRulesShader brick list");
+
+	/* The seed shader adds the cells of a CubeSeed to the current cell buffer. Each invocation handles one word of 4
+	   cells of the cube, and flags the brick if it set any cells. */
+	std::string seedShaderSource =
+R"(
+#version 430 core
 
-	if (numStates < 2 || numStates > 255)
-		return;
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
 
-	newRuleFlags |= (uint64_t) numStates << 54;
+layout(std430, binding = 0) buffer CurrentState
+{
+	uint cells[];
+} currentState;
 
-	newRuleFlags |= (uint64_t) 1 << 63;
+layout(std430, binding = 1) buffer CurrentBrickFlags
+{
+	uint flags[];
+} currentBrickFlags;
 
-	// *** END PARSE RULE STRING ***
+// The cube is from seedBegin to seedEnd - 1, and a cell in it is alive if the random number of its index is a multiple of density
+uniform ivec3 seedBegin;
+uniform ivec3 seedEnd;
+uniform uint density;
+uniform uint key;
 
-	// *** BEGIN OPENGL BUFFER/SHADER SETUP ***
+const int WIDTH = $$WIDTH;
+const int HEIGHT = $$HEIGHT;
+const int BRICK_SIZE = $$BRICK_SIZE;
+const int BRICKS_X = $$BRICKS_X;
+const int BRICKS_Y = $$BRICKS_Y;
 
-	// We are generating a new rule so we need a new shader. Delete the old shader and buffers.
-	cleanup();
+// Philox-2x32-10, the same as seedRandom() on the CPU
+uint seedRandom(uint counter, uint key)
+{
+	uint x0 = counter;
+	uint x1 = 0u;
+	for (int round = 0; round < 10; round++)
+	{
+		uint high, low;
+		umulExtended(0xd256d193u, x0, high, low);
+		x0 = high ^ key ^ x1;
+		x1 = low;
+		key += 0x9e3779b9u;
+	}
+	return x0;
+}
 
-	// Initialize cell buffer to 0 so the OpenGL buffers will be initialized to an empty state.
-	cells = new uint32_t[cellsSize];
-	for (int i = 0; i < cellsSize; i++)
-		cells[i] = 0;
+void main()
+{
+	ivec3 position = ivec3((seedBegin.x / 4 + int(gl_GlobalInvocationID.x)) * 4, seedBegin.yz + ivec3(gl_GlobalInvocationID).yz);
+	if (any(greaterThanEqual(position, seedEnd)))
+		return;
 
-	/* We generate 2 int buffers, one for the previous state of the cellular automaton, and one for the future state. 
-	   The compute shader will read data from the previous state buffer and write data to the future state buffer.
-	   These buffers are designed to be swapped before each simulation so that buffer data never has to be copied. */
-	glGenBuffers(2, cellSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSSBO[0]);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * static_cast<GLsizeiptr>(cellsSize), cells, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSSBO[1]);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * static_cast<GLsizeiptr>(cellsSize), cells, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	uint index = uint(position.x + position.y * WIDTH + position.z * WIDTH * HEIGHT);
+	uint word = currentState.cells[index / 4];
+	uint newWord = word;
+	for (int i = 0; i < 4; i++)
+	{
+		if (position.x + i >= seedBegin.x && position.x + i < seedEnd.x && seedRandom(index + uint(i), key) % density == 0u)
+			newWord = (newWord & ~(0xffu << (8 * i))) | (1u << (8 * i));
+	}
+	if (newWord != word)
+	{
+		currentState.cells[index / 4] = newWord;
+		ivec3 brick = position / BRICK_SIZE;
+		currentBrickFlags.flags[brick.x + brick.y * BRICKS_X + brick.z * BRICKS_X * BRICKS_Y] = 1u;
+	}
+}
+)";
+	stringReplace(seedShaderSource, "$$WIDTH", std::to_string(width));
+	stringReplace(seedShaderSource, "$$HEIGHT", std::to_string(height));
+	stringReplace(seedShaderSource, "$$BRICK_SIZE", std::to_string(BRICK_SIZE));
+	stringReplace(seedShaderSource, "$$BRICKS_X", std::to_string(bricksX));
+	stringReplace(seedShaderSource, "$$BRICKS_Y", std::to_string(bricksY));
+	seedProgram = createComputeProgram(seedShaderSource, "CellRulesShader seed");
+	seedBeginUniformLocation = glGetUniformLocation(seedProgram, "seedBegin");
+	seedEndUniformLocation = glGetUniformLocation(seedProgram, "seedEnd");
+	seedDensityUniformLocation = glGetUniformLocation(seedProgram, "density");
+	seedKeyUniformLocation = glGetUniformLocation(seedProgram, "key");
 
+	// *** END OPENGL BUFFER/SHADER SETUP ***
+}
+
+GLuint CellRulesShader::startRulesProgram(const CellRule& newRule)
+{
 	// To better understand this compute shader, print the formatted source string to the console.
 	std::string computeShaderSource = 
 R"(
 #version 430 core
 
-layout(local_size_x = 2, local_size_y = 2, local_size_z = 2) in;
-
+#define FACE_MASKS $$FACE_MASKS
+// Cells per side of the shared memory tile, 0 to read the neighbors straight from the previous state buffer
+#define TILE_SIZE $$TILE_SIZE
+// Largest offset of a neighbor along y and z. Along x the neighbors are always within the words left and right.
+#define RADIUS $$RADIUS
+#define RULE_TABLE $$RULE_TABLE
+#define STATE_HASH $$STATE_HASH
+
+/* One work group simulates one brick of BRICK_SIZE^3 cells, which is BRICK_SIZE / 4 words wide. With tiles the work
+   group is one tile, and it simulates the tiles of its brick one after the other. */
+#if TILE_SIZE
+layout(local_size_x = $$TILE_WORDS, local_size_y = $$TILE_SIZE, local_size_z = $$TILE_SIZE) in;
+#else
+layout(local_size_x = $$BRICK_WORDS, local_size_y = $$BRICK_SIZE, local_size_z = $$BRICK_SIZE) in;
+#endif
+
+// Cells are 8 bits each, packed 4 per uint along the x axis (the first cell is in the lowest byte)
 layout(std430, binding = 0) buffer PreviousState 
 {
 	uint cells[];
@@ -172,260 +378,1256 @@ layout(std430, binding = 1) buffer FutureState
 	uint cells[];
 } futureState;
 
+// Bricks to simulate, generated by the brick list shader. Every other brick is empty and stays empty.
+layout(std430, binding = 2) buffer BrickList
+{
+	uint numGroupsX;
+	uint numGroupsY;
+	uint numGroupsZ;
+	uint count;
+	uint bricks[];
+} brickList;
+
+// Whether each brick of the future state contains any non-zero cells
+layout(std430, binding = 3) buffer FutureBrickFlags
+{
+	uint flags[];
+} futureBrickFlags;
+
+#if FACE_MASKS
+// Visible sides of each cell of the previous state, packed like the cells, see CellRulesShader::getFaceMaskSSBO
+layout(std430, binding = 4) buffer FaceMasks
+{
+	uint masks[];
+} faceMasks;
+
+// Number of visible faces in each brick of the previous state
+layout(std430, binding = 5) buffer FaceCounts
+{
+	uint counts[];
+} faceCounts;
+#endif
+
+#if RULE_TABLE
+// Next state of a dead cell by its neighbor count, followed by the next state of a live cell, see CellRulesShader::setUseRuleTable
+layout(std430, binding = 6) buffer RuleTable
+{
+	uint next[];
+} ruleTable;
+
+const int MAX_NEIGHBORS = $$MAX_NEIGHBORS;
+#endif
+
+#if STATE_HASH
+// Hash of each generation, the XOR of the hashes of the non-zero words of the future state (see StateHistory), 2 uints per slot
+layout(std430, binding = 7) buffer StateHashes
+{
+	uint hashes[];
+} stateHashes;
+
+// Slot of this generation in stateHashes, cleared before the dispatch
+layout(location = 0) uniform uint hashSlot;
+
+// GLSL copy of hashCellWord() in StateHistory.cpp, returns the low half first
+uvec2 hashCellWord(uint index, uint word)
+{
+	uint x0 = word;
+	uint x1 = index;
+	uint key = 0x85ebca6bu;
+	for (int round = 0; round < 10; round++)
+	{
+		uint high, low;
+		umulExtended(0xd256d193u, x0, high, low);
+		x0 = high ^ key ^ x1;
+		x1 = low;
+		key += 0x9e3779b9u;
+	}
+	return uvec2(x0, x1);
+}
+#endif
+
 const int WIDTH = $$WIDTH;
 const int HEIGHT = $$HEIGHT;
 const int DEPTH = $$DEPTH;
-const int WIDTH_HEIGHT = WIDTH * HEIGHT;
+// Width of the grid in packed words
+const int WIDTH_WORDS = WIDTH / 4;
+const int WIDTH_HEIGHT = WIDTH_WORDS * HEIGHT;
 const int WIDTH_HEIGHT_DEPTH = WIDTH_HEIGHT * DEPTH;
 
 const int NUM_STATES = $$NUM_STATES;
 
-void main() 
+const int BRICK_SIZE = $$BRICK_SIZE;
+const int BRICK_WORDS = $$BRICK_WORDS;
+const int BRICKS_X = (WIDTH + BRICK_SIZE - 1) / BRICK_SIZE;
+const int BRICKS_Y = (HEIGHT + BRICK_SIZE - 1) / BRICK_SIZE;
+
+shared uint brickAlive;
+shared uint brickFaces;
+#if STATE_HASH
+// Hash of the words of the brick, and of the words written by this invocation
+shared uint brickHash[2];
+uvec2 wordHash = uvec2(0);
+#endif
+
+#if TILE_SIZE
+/* The words of the tile plus a border of one word along x and RADIUS words along y and z, loaded once per tile so each
+   word of the previous state is read from the buffer about once instead of once per neighbor row. The border wraps
+   around the grid like the neighbors. */
+const int TILE_WORDS = TILE_SIZE / 4;
+const ivec3 TILE_BORDER = ivec3(1, RADIUS, RADIUS);
+const ivec3 TILE_DIMENSIONS = ivec3(TILE_WORDS, TILE_SIZE, TILE_SIZE) + 2 * TILE_BORDER;
+const int TILE_ROW = TILE_DIMENSIONS.x;
+const int TILE_SLICE = TILE_DIMENSIONS.x * TILE_DIMENSIONS.y;
+const int TILE_LENGTH = TILE_SLICE * TILE_DIMENSIONS.z;
+const int TILE_INVOCATIONS = TILE_WORDS * TILE_SIZE * TILE_SIZE;
+shared uint tile[TILE_LENGTH];
+
+// Indices passed to readWord are in the tile
+const int ROW_STRIDE = TILE_ROW;
+const int SLICE_STRIDE = TILE_SLICE;
+uint readWord(int index)
 {
-	int index = int(gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * WIDTH + gl_GlobalInvocationID.z * WIDTH_HEIGHT);
-	if (gl_GlobalInvocationID.x >= WIDTH || gl_GlobalInvocationID.y >= HEIGHT || gl_GlobalInvocationID.z >= DEPTH)
-		return;
-
-	// Values for incrementing index within 3D array by 1 unit in each direction. If index will be out of grid boundaries, wrap index back around to other side (that is what the ternary conditionals are for).
-	// Bear in mind we are really using a 1D array, so we must increment by the appropriate offset in each dimension (i.e. going up 1 unit in the y direction means increment index by WIDTH, not 1).
-	const int LEFT = gl_GlobalInvocationID.x == 0 ? WIDTH - 1 : -1;
-	const int RIGHT = gl_GlobalInvocationID.x == WIDTH - 1 ? -(WIDTH - 1) : 1;
-	const int DOWN = gl_GlobalInvocationID.y == 0 ? WIDTH_HEIGHT - WIDTH : -WIDTH;
-	const int UP = gl_GlobalInvocationID.y == HEIGHT - 1 ? -(WIDTH_HEIGHT - WIDTH) : WIDTH;
-	const int BACKWARD = gl_GlobalInvocationID.z == 0 ? WIDTH_HEIGHT_DEPTH - WIDTH_HEIGHT : -WIDTH_HEIGHT;
-	const int FORWARD = gl_GlobalInvocationID.z == DEPTH - 1 ? -(WIDTH_HEIGHT_DEPTH - WIDTH_HEIGHT) : WIDTH_HEIGHT;
-
-	// Count total number of live neighbors surrounding each cell (there are 26 neighboring cells, 3x3x3 - 1 = 27 - 1 = 26)
-	// COUNT_NEIGHBORS is replaced by 26 statements to count each neighbor; view the code in the console window to see how this works.
-	int n = 0;
-	$$COUNT_NEIGHBORS
-
-	// Prepare the previous cell and future cell states
-	uint state = previousState.cells[index];
-	uint newState = 0;
+	return tile[index];
+}
 
-	// Alive
-	if (state == 1)
+// Load the tile whose first word is at origin (in words along x and cells along y and z)
+void loadTile(ivec3 origin)
+{
+	const ivec3 gridSize = ivec3(WIDTH_WORDS, HEIGHT, DEPTH);
+	for (int i = int(gl_LocalInvocationIndex); i < TILE_LENGTH; i += TILE_INVOCATIONS)
 	{
-		// A live cell may stay alive if the appropriate number of neighboring cells are alive given by CellRulesShader instance rules
-		if ($$STAY_ALIVE_RULES)
-		{
-			newState = 1;
-		}
-		// Either set cell to 0 (dead) or set to maximum refractory state (also dead)
-		else
-		{
-			$$CELL_DIE
-		}
+		ivec3 tilePosition = ivec3(i % TILE_ROW, (i / TILE_ROW) % TILE_DIMENSIONS.y, i / TILE_SLICE);
+		// Words past the far edge of the grid only border cells outside of it, which are not simulated
+		ivec3 position = (origin + tilePosition - TILE_BORDER + RADIUS * gridSize) % gridSize;
+		tile[i] = previousState.cells[position.x + position.y * WIDTH_WORDS + position.z * WIDTH_HEIGHT];
 	}
-	// Dead
-	else
+}
+#else
+// Indices passed to readWord are in the previous state buffer
+const int ROW_STRIDE = WIDTH_WORDS;
+const int SLICE_STRIDE = WIDTH_HEIGHT;
+uint readWord(int index)
+{
+	return previousState.cells[index];
+}
+#endif
+
+// Whether each cell of one row of the neighborhood is alive. The row is the 8 cells from 2 cells left of the word to 2
+// cells right of the word, so the cells of the word itself are alive[2] to alive[5].
+int[8] rowAlive(uint leftWord, uint word, uint rightWord)
+{
+	return int[8]
+	(
+		int(((leftWord >> 16) & 0xff) == 1),
+		int((leftWord >> 24) == 1),
+		int((word & 0xff) == 1),
+		int(((word >> 8) & 0xff) == 1),
+		int(((word >> 16) & 0xff) == 1),
+		int((word >> 24) == 1),
+		int((rightWord & 0xff) == 1),
+		int(((rightWord >> 8) & 0xff) == 1)
+	);
+}
+
+// Simulate one packed word, which is 4 cells along the x axis. position is in words along x and cells along y and z,
+// index is the index of the word for readWord.
+uint simulateWord(ivec3 position, int index)
+{
+#if TILE_SIZE
+	// The border of the tile already holds the wrapped around neighbors
+	const int LEFT = -1;
+	const int RIGHT = 1;
+	const int DOWN = -ROW_STRIDE;
+	const int UP = ROW_STRIDE;
+	const int BACKWARD = -SLICE_STRIDE;
+	const int FORWARD = SLICE_STRIDE;
+	const int DOWN2 = -2 * ROW_STRIDE;
+	const int UP2 = 2 * ROW_STRIDE;
+	const int BACKWARD2 = -2 * SLICE_STRIDE;
+	const int FORWARD2 = 2 * SLICE_STRIDE;
+#else
+	// Values for incrementing index within 3D array by 1 word in each direction. If index will be out of grid boundaries, wrap index back around to other side (that is what the ternary conditionals are for).
+	// Bear in mind we are really using a 1D array, so we must increment by the appropriate offset in each dimension (i.e. going up 1 unit in the y direction means increment index by WIDTH_WORDS, not 1).
+	const int LEFT = position.x == 0 ? WIDTH_WORDS - 1 : -1;
+	const int RIGHT = position.x == WIDTH_WORDS - 1 ? -(WIDTH_WORDS - 1) : 1;
+	const int DOWN = position.y == 0 ? WIDTH_HEIGHT - WIDTH_WORDS : -WIDTH_WORDS;
+	const int UP = position.y == HEIGHT - 1 ? -(WIDTH_HEIGHT - WIDTH_WORDS) : WIDTH_WORDS;
+	const int BACKWARD = position.z == 0 ? WIDTH_HEIGHT_DEPTH - WIDTH_HEIGHT : -WIDTH_HEIGHT;
+	const int FORWARD = position.z == DEPTH - 1 ? -(WIDTH_HEIGHT_DEPTH - WIDTH_HEIGHT) : WIDTH_HEIGHT;
+	// Offsets of 2 rows or slices, only used by kernels of radius 2
+	const int DOWN2 = ((position.y + 2 * HEIGHT - 2) % HEIGHT - position.y) * WIDTH_WORDS;
+	const int UP2 = ((position.y + 2) % HEIGHT - position.y) * WIDTH_WORDS;
+	const int BACKWARD2 = ((position.z + 2 * DEPTH - 2) % DEPTH - position.z) * WIDTH_HEIGHT;
+	const int FORWARD2 = ((position.z + 2) % DEPTH - position.z) * WIDTH_HEIGHT;
+#endif
+
+	// Count total number of live neighbors surrounding each of the 4 cells (26 for the 3x3x3 Moore neighborhood, or the sum of the weights of any other neighborhood)
+	// COUNT_NEIGHBORS is replaced by 2 statements for each row of words passing through the neighborhood which has any neighbors: read the row, then add its neighbors to the counts.
+	// Rows without neighbors and cells with a weight of 0 are left out, so they cost nothing; view the code in the console window to see how this works.
+	int counts[4] = int[4](0, 0, 0, 0);
+	int alive[8];
+	$$COUNT_NEIGHBORS
+
+	uint word = readWord(index);
+	uint newWord = 0;
+	for (int i = 0; i < 4; i++)
 	{
-		// Cycle through dead refractory states 2 to (NUM_STATES-1)
-		if (state > 2)
+		int n = counts[i];
+
+		// Prepare the previous cell and future cell states
+		uint state = (word >> (8 * i)) & 0xff;
+#if RULE_TABLE
+		// Dead and live cells look up their next state, refractory states count down to 2 and then skip the alive state.
+		// Both are computed for every cell and one is selected, so there are no branches.
+		uint tableState = ruleTable.next[min(state, 1u) * uint(MAX_NEIGHBORS + 1) + uint(n)];
+		uint newState = state < 2 ? tableState : (state - 1) * uint(state > 2);
+#else
+		uint newState = 0;
+
+		// Alive
+		if (state == 1)
 		{
-			newState = state - 1;
-		}
-		// At last refractory state, skip 1 (alive) state and set to 0 (dead) state
-		else if (state == 2)
-		{
-			newState = 0;
+			// A live cell may stay alive if the appropriate number of neighboring cells are alive given by CellRulesShader instance rules
+			if ($$STAY_ALIVE_RULES)
+			{
+				newState = 1;
+			}
+			// Either set cell to 0 (dead) or set to maximum refractory state (also dead)
+			else
+			{
+				$$CELL_DIE
+			}
 		}
+		// Dead
 		else
 		{
-			// A dead cell may be born if the appropriate number of neighboring cells are alive given by CellRulesShader instance rules
-			if ($$BORN_RULES)
+			// Cycle through dead refractory states 2 to (NUM_STATES-1)
+			if (state > 2)
 			{
-				newState = 1;
+				newState = state - 1;
 			}
-			else
+			// At last refractory state, skip 1 (alive) state and set to 0 (dead) state
+			else if (state == 2)
 			{
 				newState = 0;
 			}
+			else
+			{
+				// A dead cell may be born if the appropriate number of neighboring cells are alive given by CellRulesShader instance rules
+				if ($$BORN_RULES)
+				{
+					newState = 1;
+				}
+				else
+				{
+					newState = 0;
+				}
+			}
 		}
+#endif
+
+		newWord |= newState << (8 * i);
+	}
+
+	return newWord;
+}
+
+#if FACE_MASKS
+/* Face masks of the 4 cells of one word of the previous state. Unlike the neighbor counts these don't wrap around,
+   faces on the edge of the grid are always visible just like in CellMeshingShader. The neighbor words were all just
+   read by countRow, so these reads hit the tile or the cache. */
+uint faceMaskWord(ivec3 position, int index, out uint numFaces)
+{
+	uint word = readWord(index);
+	uint leftWord = position.x == 0 ? 0 : readWord(index - 1);
+	uint rightWord = position.x == WIDTH_WORDS - 1 ? 0 : readWord(index + 1);
+	uint downWord = position.y == 0 ? 0 : readWord(index - ROW_STRIDE);
+	uint upWord = position.y == HEIGHT - 1 ? 0 : readWord(index + ROW_STRIDE);
+	uint backWord = position.z == 0 ? 0 : readWord(index - SLICE_STRIDE);
+	uint frontWord = position.z == DEPTH - 1 ? 0 : readWord(index + SLICE_STRIDE);
+	// The row of cells from the cell left of the word to the cell right of the word
+	uint row[6] = uint[6](leftWord >> 24, word & 0xff, (word >> 8) & 0xff, (word >> 16) & 0xff, word >> 24, rightWord & 0xff);
+
+	uint maskWord = 0;
+	numFaces = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		if (row[i + 1] == 0)
+			continue;
+		int shift = 8 * i;
+		uint mask = uint(row[i] == 0) | (uint(row[i + 2] == 0) << 1) |
+			(uint(((downWord >> shift) & 0xff) == 0) << 2) | (uint(((upWord >> shift) & 0xff) == 0) << 3) |
+			(uint(((backWord >> shift) & 0xff) == 0) << 4) | (uint(((frontWord >> shift) & 0xff) == 0) << 5);
+		numFaces += uint(bitCount(mask));
+		maskWord |= mask << shift;
 	}
+	return maskWord;
+}
+#endif
 
-	// Set output buffer cell
-	futureState.cells[index] = newState;
+// Simulate the word at position and write it to the future state. readIndex is its index for readWord.
+void simulatePosition(ivec3 position, int readIndex)
+{
+	// Bricks on the far edges of the grid may be partially outside of it
+	if (position.x < WIDTH_WORDS && position.y < HEIGHT && position.z < DEPTH)
+	{
+		int index = position.x + position.y * WIDTH_WORDS + position.z * WIDTH_HEIGHT;
+		uint newWord = simulateWord(position, readIndex);
+
+		// Set output buffer word
+		futureState.cells[index] = newWord;
+		if (newWord != 0)
+		{
+			atomicOr(brickAlive, 1);
+#if STATE_HASH
+			wordHash ^= hashCellWord(uint(index), newWord);
+#endif
+		}
+
+#if FACE_MASKS
+		uint numFaces;
+		faceMasks.masks[index] = faceMaskWord(position, readIndex, numFaces);
+		if (numFaces != 0)
+			atomicAdd(brickFaces, numFaces);
+#endif
+	}
+}
+
+void main() 
+{
+	// The group count is rounded up to fill a 2D grid of work groups, so some groups may have no brick
+	uint groupIndex = gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+	if (groupIndex >= brickList.count)
+		return;
+
+	uint brick = brickList.bricks[groupIndex];
+	ivec3 brickPosition = ivec3(brick % BRICKS_X, (brick / BRICKS_X) % BRICKS_Y, brick / (BRICKS_X * BRICKS_Y));
+	ivec3 brickOrigin = brickPosition * ivec3(BRICK_WORDS, BRICK_SIZE, BRICK_SIZE);
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		brickAlive = 0;
+		brickFaces = 0;
+#if STATE_HASH
+		brickHash[0] = 0;
+		brickHash[1] = 0;
+#endif
+	}
+	barrier();
+
+#if TILE_SIZE
+	const int TILES_PER_SIDE = BRICK_SIZE / TILE_SIZE;
+	for (int i = 0; i < TILES_PER_SIDE * TILES_PER_SIDE * TILES_PER_SIDE; i++)
+	{
+		ivec3 tilePosition = ivec3(i % TILES_PER_SIDE, (i / TILES_PER_SIDE) % TILES_PER_SIDE, i / (TILES_PER_SIDE * TILES_PER_SIDE));
+		ivec3 tileOrigin = brickOrigin + tilePosition * ivec3(TILE_WORDS, TILE_SIZE, TILE_SIZE);
+		// The previous tile must be done before it is overwritten
+		if (i > 0)
+			barrier();
+		loadTile(tileOrigin);
+		barrier();
+
+		ivec3 tileIndex = ivec3(gl_LocalInvocationID) + TILE_BORDER;
+		simulatePosition(tileOrigin + ivec3(gl_LocalInvocationID), tileIndex.x + tileIndex.y * TILE_ROW + tileIndex.z * TILE_SLICE);
+	}
+#else
+	ivec3 position = brickOrigin + ivec3(gl_LocalInvocationID);
+	simulatePosition(position, position.x + position.y * WIDTH_WORDS + position.z * WIDTH_HEIGHT);
+#endif
+
+#if STATE_HASH
+	// Reduce the hashes in shared memory first, so there is only one global atomic per brick
+	if (wordHash != uvec2(0))
+	{
+		atomicXor(brickHash[0], wordHash.x);
+		atomicXor(brickHash[1], wordHash.y);
+	}
+#endif
+	barrier();
+	if (gl_LocalInvocationIndex == 0)
+	{
+		futureBrickFlags.flags[brick] = brickAlive;
+#if FACE_MASKS
+		faceCounts.counts[brick] = brickFaces;
+#endif
+#if STATE_HASH
+		if (brickHash[0] != 0 || brickHash[1] != 0)
+		{
+			atomicXor(stateHashes.hashes[2 * hashSlot], brickHash[0]);
+			atomicXor(stateHashes.hashes[2 * hashSlot + 1], brickHash[1]);
+		}
+#endif
+	}
 }
 )";
 	stringReplace(computeShaderSource, "$$WIDTH", std::to_string(width));
 	stringReplace(computeShaderSource, "$$HEIGHT", std::to_string(height));
 	stringReplace(computeShaderSource, "$$DEPTH", std::to_string(depth));
-	stringReplace(computeShaderSource, "$$NUM_STATES", std::to_string(getNumStates(newRuleFlags)));
+	stringReplace(computeShaderSource, "$$NUM_STATES", std::to_string(newRule.getNumStates()));
+	stringReplace(computeShaderSource, "$$BRICK_SIZE", std::to_string(BRICK_SIZE));
+	stringReplace(computeShaderSource, "$$BRICK_WORDS", std::to_string(BRICK_SIZE / 4));
+	stringReplace(computeShaderSource, "$$FACE_MASKS", faceMasks ? "1" : "0");
+	stringReplace(computeShaderSource, "$$TILE_SIZE", std::to_string(tileSize));
+	stringReplace(computeShaderSource, "$$TILE_WORDS", std::to_string(tileSize / 4));
+	stringReplace(computeShaderSource, "$$RADIUS", std::to_string(newRule.getRadius()));
+	stringReplace(computeShaderSource, "$$RULE_TABLE", useRuleTable ? "1" : "0");
+	stringReplace(computeShaderSource, "$$STATE_HASH", trackStates ? "1" : "0");
+	stringReplace(computeShaderSource, "$$MAX_NEIGHBORS", std::to_string(newRule.getMaxNeighbors()));
+	const int radius = newRule.getRadius();
+	const char* yOffsets[5] = { " + DOWN2", " + DOWN", "", " + UP", " + UP2" };
+	const char* zOffsets[5] = { " + BACKWARD2", " + BACKWARD", "", " + FORWARD", " + FORWARD2" };
 	std::string countNeighborsStr;
-	for (int z = 0; z < 3; z++)
+	for (int z = -radius; z <= radius; z++)
 	{
-		for (int y = 0; y < 3; y++)
+		for (int y = -radius; y <= radius; y++)
 		{
-			for (int x = 0; x < 3; x++)
+			// The terms of each of the 4 cells, and whether the words left and right of the row are needed
+			std::string terms[4];
+			bool needsLeft = false;
+			bool needsRight = false;
+			for (int x = -radius; x <= radius; x++)
 			{
-				if (!(x == 1 && y == 1 && z == 1))
+				int weight = newRule.getWeight(x, y, z);
+				if (weight == 0)
+					continue;
+				needsLeft = needsLeft || x < 0;
+				needsRight = needsRight || x > 0;
+				for (int i = 0; i < 4; i++)
 				{
-					countNeighborsStr += "\tn += int(previousState.cells[index + ";
-					bool plus = false;
-					if (x != 1)
-					{
-						countNeighborsStr += x == 0 ? "LEFT" : x == 2 ? "RIGHT" : "";
-						plus = true;
-					}
-					if (y != 1)
-					{
-						if (plus)
-							countNeighborsStr += " + ";
-						countNeighborsStr += y == 0 ? "DOWN" : y == 2 ? "UP" : "";
-						plus = true;
-					}
-					if (z != 1)
-					{
-						if (plus)
-							countNeighborsStr += " + ";
-						countNeighborsStr += z == 0 ? "BACKWARD" : z == 2 ? "FORWARD" : "";
-					}
-					countNeighborsStr += "] == 1);\n";
+					if (!terms[i].empty())
+						terms[i] += " + ";
+					if (weight != 1)
+						terms[i] += std::to_string(weight) + " * ";
+					terms[i] += "alive[" + std::to_string(i + 2 + x) + "]";
 				}
 			}
+			if (terms[0].empty())
+				continue;
+
+			std::string rowIndex = std::string("index") + yOffsets[y + 2] + zOffsets[z + 2];
+			countNeighborsStr += "\talive = rowAlive(";
+			countNeighborsStr += needsLeft ? "readWord(" + rowIndex + " + LEFT), " : "0u, ";
+			countNeighborsStr += "readWord(" + rowIndex + "), ";
+			countNeighborsStr += needsRight ? "readWord(" + rowIndex + " + RIGHT));\n" : "0u);\n";
+			for (int i = 0; i < 4; i++)
+				countNeighborsStr += "\tcounts[" + std::to_string(i) + "] += " + terms[i] + ";\n";
 		}
 	}
 	stringReplace(computeShaderSource, "\t$$COUNT_NEIGHBORS", countNeighborsStr);
 
-	std::string bornRulesStr;
-	bool orFlag = false;
-	for (int i = 0; i < 27; i++)
-	{
-		if (hasRuleFlagBornBit(newRuleFlags, i))
-		{
-			if (orFlag)
-				bornRulesStr += " || ";
-			bornRulesStr += "n == " + std::to_string(i);
-			orFlag = true;
-		}
-	}
-	stringReplace(computeShaderSource, "$$BORN_RULES", bornRulesStr);
+	stringReplace(computeShaderSource, "$$BORN_RULES", countCondition(newRule, true));
+	stringReplace(computeShaderSource, "$$STAY_ALIVE_RULES", countCondition(newRule, false));
 
-	std::string stayAliveRulesStr;
-	orFlag = false;
-	for (int i = 0; i < 27; i++)
-	{
-		if (hasRuleFlagStayAliveBit(newRuleFlags, i))
-		{
-			if (orFlag)
-				stayAliveRulesStr += " || ";
-			stayAliveRulesStr += "n == " + std::to_string(i);
-			orFlag = true;
-		}
-	}
-	stringReplace(computeShaderSource, "$$STAY_ALIVE_RULES", stayAliveRulesStr);
-
-	if (getNumStates(newRuleFlags) > 2)
+	if (newRule.getNumStates() > 2)
 		stringReplace(computeShaderSource, "$$CELL_DIE", "newState = uint(NUM_STATES) - 1;");
 	else
 		stringReplace(computeShaderSource, "$$CELL_DIE", "newState = 0;");
 
-	const char* shaderSourceStr = computeShaderSource.c_str();
+	return startComputeProgram(computeShaderSource);
+}
 
-	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
-	glShaderSource(shader, 1, &shaderSourceStr, nullptr);
-	glCompileShader(shader);
-	std::cout << "CellRulesShader compilation:" << std::endl;
-	printShaderCompileErrors(shader);
-	std::cout << std::endl;
+void CellRulesShader::startSeparablePrograms(const CellRule& newRule, GLuint programs[3])
+{
+	/* The (2 RADIUS + 1)^3 box around a cell is counted in 3 passes. Each invocation walks one line of the grid along
+	   the axis of its pass and keeps a running sum of the window of 2 RADIUS + 1 values around the current cell, so
+	   every pass costs 2 reads per cell whatever the radius. The window wraps around the grid like the neighbors of
+	   the radius 1 shader. */
+	std::string separableShaderSource =
+R"(
+#version 430 core
 
-	computeProgram = glCreateProgram();
-	glAttachShader(computeProgram, shader);
-	glLinkProgram(computeProgram);
+#define PASS $$PASS
+#define RULE_TABLE $$RULE_TABLE
+#define STATE_HASH $$STATE_HASH
 
-	glDeleteShader(shader);
+layout(local_size_x = 64) in;
 
-	// *** END OPENGL BUFFER/SHADER SETUP ***
+// Cells are 8 bits each, packed 4 per uint along the x axis (the first cell is in the lowest byte)
+layout(std430, binding = 0) buffer PreviousState
+{
+	uint cells[];
+} previousState;
+
+layout(std430, binding = 1) buffer FutureState
+{
+	uint cells[];
+} futureState;
+
+// Box sums written by the previous pass and by this pass, packed like the cells
+layout(std430, binding = 2) buffer InputSums
+{
+	uint sums[];
+} inputSums;
+
+layout(std430, binding = 3) buffer OutputSums
+{
+	uint sums[];
+} outputSums;
+
+// Whether each brick of the future state contains any non-zero cells, cleared before the first pass
+layout(std430, binding = 4) buffer FutureBrickFlags
+{
+	uint flags[];
+} futureBrickFlags;
+
+#if RULE_TABLE
+// Next state of a dead cell by its neighbor count, followed by the next state of a live cell
+layout(std430, binding = 5) buffer RuleTable
+{
+	uint next[];
+} ruleTable;
+#endif
 
-	ruleFlags = newRuleFlags;
+#if STATE_HASH
+// Hash of each generation, the XOR of the hashes of the non-zero words of the future state (see StateHistory), 2 uints per slot
+layout(std430, binding = 6) buffer StateHashes
+{
+	uint hashes[];
+} stateHashes;
+
+// Slot of this generation in stateHashes, cleared before the dispatch
+layout(location = 0) uniform uint hashSlot;
+
+// GLSL copy of hashCellWord() in StateHistory.cpp, returns the low half first
+uvec2 hashCellWord(uint index, uint word)
+{
+	uint x0 = word;
+	uint x1 = index;
+	uint key = 0x85ebca6bu;
+	for (int round = 0; round < 10; round++)
+	{
+		uint high, low;
+		umulExtended(0xd256d193u, x0, high, low);
+		x0 = high ^ key ^ x1;
+		x1 = low;
+		key += 0x9e3779b9u;
+	}
+	return uvec2(x0, x1);
 }
+#endif
 
-std::string CellRulesShader::getRule()
+const int WIDTH = $$WIDTH;
+const int HEIGHT = $$HEIGHT;
+const int DEPTH = $$DEPTH;
+const int WIDTH_WORDS = WIDTH / 4;
+const int WIDTH_HEIGHT = WIDTH_WORDS * HEIGHT;
+
+const int RADIUS = $$RADIUS;
+const int NUM_STATES = $$NUM_STATES;
+const int MAX_NEIGHBORS = (2 * RADIUS + 1) * (2 * RADIUS + 1) * (2 * RADIUS + 1) - 1;
+
+const int BRICK_SIZE = $$BRICK_SIZE;
+const int BRICKS_X = (WIDTH + BRICK_SIZE - 1) / BRICK_SIZE;
+const int BRICKS_Y = (HEIGHT + BRICK_SIZE - 1) / BRICK_SIZE;
+
+/* Index i >= -RADIUS wrapped around into 0 to size - 1, also for windows wider than the grid. % is undefined for
+   negative operands in GLSL, so i is first moved up by a multiple of size. */
+int wrap(int i, int size)
 {
-	if (ruleFlags == 0)
-		return "UndefinedRule";
-	std::string rule = "";
+	return (i + size * (RADIUS / size + 1)) % size;
+}
 
-	bool dashFlag = false;
-	rule += "B ";
-	for (int i = 0; i < 27; i++)
+#if PASS == 0
+uint isAlive(int rowIndex, int x)
+{
+	return uint(((previousState.cells[rowIndex + (x >> 2)] >> (8 * (x & 3))) & 0xff) == 1);
+}
+
+// Live cells within RADIUS along x, at most 2 RADIUS + 1
+void main()
+{
+	int row = int(gl_GlobalInvocationID.x);
+	if (row >= HEIGHT * DEPTH)
+		return;
+
+	int rowIndex = row * WIDTH_WORDS;
+	uint sum = 0;
+	for (int i = -RADIUS; i <= RADIUS; i++)
+		sum += isAlive(rowIndex, wrap(i, WIDTH));
+	int enter = wrap(RADIUS + 1, WIDTH);
+	int leave = wrap(-RADIUS, WIDTH);
+	for (int x = 0; x < WIDTH_WORDS; x++)
 	{
-		if (hasRuleFlagBornBit(ruleFlags, i))
+		uint word = 0;
+		for (int i = 0; i < 4; i++)
 		{
-			if (dashFlag)
-				rule += "-";
-			rule += std::to_string(i);
-			dashFlag = true;
+			word |= sum << (8 * i);
+			sum = sum + isAlive(rowIndex, enter) - isAlive(rowIndex, leave);
+			enter = enter + 1 == WIDTH ? 0 : enter + 1;
+			leave = leave + 1 == WIDTH ? 0 : leave + 1;
 		}
+		outputSums.sums[rowIndex + x] = word;
+	}
+}
+#elif PASS == 1
+/* Sums of the first pass within RADIUS along y, at most (2 RADIUS + 1)^2 = 121. The 4 sums of a word never leave 0 to
+   255 as long as the new value is added before the old one is subtracted, so whole words are added at once. */
+void main()
+{
+	int column = int(gl_GlobalInvocationID.x);
+	if (column >= WIDTH_WORDS * DEPTH)
+		return;
+
+	int columnIndex = column % WIDTH_WORDS + (column / WIDTH_WORDS) * WIDTH_HEIGHT;
+	uint sum = 0;
+	for (int i = -RADIUS; i <= RADIUS; i++)
+		sum += inputSums.sums[columnIndex + wrap(i, HEIGHT) * WIDTH_WORDS];
+	int enter = wrap(RADIUS + 1, HEIGHT);
+	int leave = wrap(-RADIUS, HEIGHT);
+	for (int y = 0; y < HEIGHT; y++)
+	{
+		outputSums.sums[columnIndex + y * WIDTH_WORDS] = sum;
+		sum = sum + inputSums.sums[columnIndex + enter * WIDTH_WORDS] - inputSums.sums[columnIndex + leave * WIDTH_WORDS];
+		enter = enter + 1 == HEIGHT ? 0 : enter + 1;
+		leave = leave + 1 == HEIGHT ? 0 : leave + 1;
 	}
-	dashFlag = false;
-	rule += " / S ";
-	for (int i = 0; i < 27; i++)
+}
+#else
+uvec4 unpackSums(uint word)
+{
+	return uvec4(word & 0xff, (word >> 8) & 0xff, (word >> 16) & 0xff, word >> 24);
+}
+
+uint applyRule(uint state, int n)
+{
+#if RULE_TABLE
+	uint tableState = ruleTable.next[min(state, 1u) * uint(MAX_NEIGHBORS + 1) + uint(n)];
+	return state < 2 ? tableState : (state - 1) * uint(state > 2);
+#else
+	if (state == 1)
+		return ($$STAY_ALIVE_RULES) ? 1 : (NUM_STATES > 2 ? uint(NUM_STATES) - 1 : 0);
+	// Cycle through the refractory states down to 2, then skip the alive state
+	if (state > 2)
+		return state - 1;
+	if (state == 2)
+		return 0;
+	return ($$BORN_RULES) ? 1 : 0;
+#endif
+}
+
+// Sums of the second pass within RADIUS along z, which counts the whole box, then apply the rule to each cell
+void main()
+{
+	int column = int(gl_GlobalInvocationID.x);
+	if (column >= WIDTH_WORDS * HEIGHT)
+		return;
+
+	int x = column % WIDTH_WORDS;
+	int y = column / WIDTH_WORDS;
+	int columnIndex = x + y * WIDTH_WORDS;
+	uvec4 sum = uvec4(0);
+	for (int i = -RADIUS; i <= RADIUS; i++)
+		sum += unpackSums(inputSums.sums[columnIndex + wrap(i, DEPTH) * WIDTH_HEIGHT]);
+	int enter = wrap(RADIUS + 1, DEPTH);
+	int leave = wrap(-RADIUS, DEPTH);
+
+	int brickRow = (x * 4) / BRICK_SIZE + (y / BRICK_SIZE) * BRICKS_X;
+	bool brickAlive = false;
+#if STATE_HASH
+	uvec2 columnHash = uvec2(0);
+#endif
+	for (int z = 0; z < DEPTH; z++)
 	{
-		if (hasRuleFlagStayAliveBit(ruleFlags, i))
+		int index = columnIndex + z * WIDTH_HEIGHT;
+		uint word = previousState.cells[index];
+		uint newWord = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			uint state = (word >> (8 * i)) & 0xff;
+			// The box around the cell also counted the cell itself
+			int n = int(sum[i]) - int(state == 1);
+			newWord |= applyRule(state, n) << (8 * i);
+		}
+		futureState.cells[index] = newWord;
+		brickAlive = brickAlive || newWord != 0;
+#if STATE_HASH
+		if (newWord != 0)
+			columnHash ^= hashCellWord(uint(index), newWord);
+#endif
+
+		// Flag the brick once this column leaves it
+		if (z % BRICK_SIZE == BRICK_SIZE - 1 || z == DEPTH - 1)
 		{
-			if (dashFlag)
-				rule += "-";
-			rule += std::to_string(i);
-			dashFlag = true;
+			if (brickAlive)
+				atomicOr(futureBrickFlags.flags[brickRow + (z / BRICK_SIZE) * BRICKS_X * BRICKS_Y], 1);
+			brickAlive = false;
 		}
+
+		sum = sum + unpackSums(inputSums.sums[columnIndex + enter * WIDTH_HEIGHT]) - unpackSums(inputSums.sums[columnIndex + leave * WIDTH_HEIGHT]);
+		enter = enter + 1 == DEPTH ? 0 : enter + 1;
+		leave = leave + 1 == DEPTH ? 0 : leave + 1;
+	}
+
+#if STATE_HASH
+	// One atomic per column, the early return above rules out reducing in shared memory first
+	if (columnHash != uvec2(0))
+	{
+		atomicXor(stateHashes.hashes[2 * hashSlot], columnHash.x);
+		atomicXor(stateHashes.hashes[2 * hashSlot + 1], columnHash.y);
 	}
-	int numStates = getNumStates(ruleFlags);
-	if (numStates != 2)
+#endif
+}
+#endif
+)";
+	stringReplace(separableShaderSource, "$$WIDTH", std::to_string(width));
+	stringReplace(separableShaderSource, "$$HEIGHT", std::to_string(height));
+	stringReplace(separableShaderSource, "$$DEPTH", std::to_string(depth));
+	stringReplace(separableShaderSource, "$$RADIUS", std::to_string(newRule.getRadius()));
+	stringReplace(separableShaderSource, "$$RULE_TABLE", useRuleTable ? "1" : "0");
+	stringReplace(separableShaderSource, "$$STATE_HASH", trackStates ? "1" : "0");
+	stringReplace(separableShaderSource, "$$NUM_STATES", std::to_string(newRule.getNumStates()));
+	stringReplace(separableShaderSource, "$$BRICK_SIZE", std::to_string(BRICK_SIZE));
+	stringReplace(separableShaderSource, "$$BORN_RULES", countCondition(newRule, true));
+	stringReplace(separableShaderSource, "$$STAY_ALIVE_RULES", countCondition(newRule, false));
+
+	for (int pass = 0; pass < 3; pass++)
 	{
-		rule += " / ";
-		rule += std::to_string(numStates);
+		std::string passSource = separableShaderSource;
+		stringReplace(passSource, "$$PASS", std::to_string(pass));
+		programs[pass] = startComputeProgram(passSource);
 	}
+}
 
-	return rule;
+std::string CellRulesShader::getRule()
+{
+	return pendingRule.isValid() ? pendingRule.toString() : cellRule.toString();
 }
 
-uint32_t* CellRulesShader::getCells()
+uint8_t* CellRulesShader::getCells()
 {
 	return cells;
 }
 
 void CellRulesShader::updateGPUCells()
 {
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSSBO[0]);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * cellsSize, cells, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	updateGPUCells(0, depth - 1);
+}
+
+void CellRulesShader::updateGPUCells(int firstZ, int lastZ)
+{
+	int firstBrickZ = std::max(firstZ, 0) / BRICK_SIZE;
+	int lastBrickZ = std::min(lastZ, depth - 1) / BRICK_SIZE;
+	if (firstBrickZ > lastBrickZ)
+		return;
+	// The last brick layer also covers the padding at the end of the buffer
+	int sliceSize = width * height;
+	int begin = firstBrickZ * BRICK_SIZE * sliceSize;
+	int end = lastBrickZ == bricksZ - 1 ? paddedCellsSize : (lastBrickZ + 1) * BRICK_SIZE * sliceSize;
+
+	generation++;
+	faceMasksValid = false;
+	resetStateHistory();
+	if (cpuRules != nullptr)
+	{
+		// The CPU engines take the whole grid, so fill in their current cells around the updated slices
+		if (begin != 0 || end != paddedCellsSize)
+		{
+			std::vector<uint8_t> slices(cells + begin, cells + end);
+			cpuRules->getCells(cells);
+			std::copy(slices.begin(), slices.end(), cells + begin);
+		}
+		cpuRules->setCells(cells);
+		cellSSBOOutdated = true;
+		return;
+	}
+
+	transfer.upload(cellSSBO[0], begin, end - begin, cells + begin);
+	uploadBrickFlags(firstBrickZ, lastBrickZ);
 }
 
 void CellRulesShader::fetchGPUCells()
 {
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSSBO[0]);
-	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(uint32_t) * cellsSize, cells);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	if (cpuRules != nullptr)
+	{
+		cpuRules->getCells(cells);
+		return;
+	}
+
+	transfer.startReadback(cellSSBO[0], paddedCellsSize);
+	transfer.finishReadback(cells, true);
+}
+
+void CellRulesShader::requestGPUCells()
+{
+	if (cpuRules == nullptr)
+		transfer.startReadback(cellSSBO[0], paddedCellsSize);
+}
+
+bool CellRulesShader::readRequestedGPUCells()
+{
+	if (cpuRules != nullptr)
+	{
+		cpuRules->getCells(cells);
+		return true;
+	}
+
+	return transfer.finishReadback(cells);
+}
+
+void CellRulesShader::seedCells(CubeSeed seed, uint32_t key)
+{
+	int xBegin = seed.getBegin(width), xEnd = seed.getEnd(width);
+	int yBegin = seed.getBegin(height), yEnd = seed.getEnd(height);
+	int zBegin = seed.getBegin(depth), zEnd = seed.getEnd(depth);
+	if (seed.density <= 0 || xBegin >= xEnd || yBegin >= yEnd || zBegin >= zEnd)
+		return;
+
+	generation++;
+	faceMasksValid = false;
+	resetStateHistory();
+	if (cpuRules != nullptr)
+	{
+		cpuRules->getCells(cells);
+		fillCubeSeed(cells, width, height, depth, seed, key, &cpuRules->getThreadPool());
+		cpuRules->setCells(cells);
+		cellSSBOOutdated = true;
+		return;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cellSSBO[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, brickFlagSSBO[0]);
+	glUseProgram(seedProgram);
+	glUniform3i(seedBeginUniformLocation, xBegin, yBegin, zBegin);
+	glUniform3i(seedEndUniformLocation, xEnd, yEnd, zEnd);
+	glUniform1ui(seedDensityUniformLocation, static_cast<GLuint>(seed.density));
+	glUniform1ui(seedKeyUniformLocation, key);
+	// One invocation per word of 4 cells, from the word containing the first x to the one containing the last
+	int wordsX = (xEnd - 1) / 4 - xBegin / 4 + 1;
+	glDispatchCompute((wordsX + 3) / 4, (yEnd - yBegin + 3) / 4, (zEnd - zBegin + 3) / 4);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+}
+
+void CellRulesShader::simulate(uint64_t generations)
+{
+	// Every generation is hashed one by one, except by HashLife, which would lose its speed
+	if (cpuRules != nullptr && (!trackStates || engine == Engine::CPUHashLife))
+	{
+		cpuRules->simulate(generations);
+		cellSSBOOutdated = true;
+		generation += generations;
+		// The history can't follow a jump, so this starts a new one
+		if (trackStates)
+			stateHistory.add(generation, cpuRules->hashState());
+		return;
+	}
+
+	for (uint64_t i = 0; i < generations; i++)
+		simulate();
 }
 
 void CellRulesShader::simulate()
 {
-	// Allow compute program to access these buffers at binding points 0 and 1
+	generation++;
+	if (cpuRules != nullptr)
+	{
+		cpuRules->simulate();
+		cellSSBOOutdated = true;
+		if (trackStates)
+			stateHistory.add(generation, cpuRules->hashState());
+		return;
+	}
+
+	// Switch to the shaders of a new rule once the driver has finished compiling them
+	if (pendingRule.isValid() && isPendingRuleReady())
+		finishRuleChange();
+
+	if (cellRule.isSeparable())
+	{
+		simulateSeparable();
+		return;
+	}
+
+	// Reset the brick list header to 0 bricks, dispatched as 0x1x1 work groups
+	const GLuint brickListHeader[4] = { 0, 1, 1, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickListBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(brickListHeader), brickListHeader);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Build the list of bricks which need to be simulated
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, brickFlagSSBO[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, brickFlagSSBO[1]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, brickListBuffer);
+	glUseProgram(brickListProgram);
+	glUniform1i(0, cellRule.isBorn(0) ? 1 : 0);
+	glDispatchCompute((numBricks + 63) / 64, 1, 1);
+	// The brick list is read by the rules shader and its header is used for the indirect dispatch
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	// Allow compute program to access these buffers at binding points 0 to 3
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cellSSBO[0]);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cellSSBO[1]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, brickFlagSSBO[1]);
+	if (faceMasks)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, faceMaskSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, faceCountSSBO);
+	}
+	if (useRuleTable)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ruleTableSSBO);
+	if (trackStates)
+		bindStateHashSlot(7);
 
 	glUseProgram(computeProgram);
-	// Dispath shader in groups of 2x2x2 to align with 'layout' declaration in shader source. (x + 1) / 2 rounds up in case of odd dimensions.
-	glDispatchCompute((width + 1) / 2, (height + 1) / 2, (depth + 1) / 2);
+	if (trackStates)
+		glUniform1ui(0, pendingHashes.back().slot);
+	// Dispatch one work group per active brick. The group counts were written into the brick list by the brick list shader.
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, brickListBuffer);
+	glDispatchComputeIndirect(0);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
 	// Prevents future operations on buffers until shader is done writing to them.
 	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	glUseProgram(0);
+	if (trackStates)
+		fenceStateHashSlot();
 
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	for (int i = 0; i < 8; i++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
 
 	// For next simulation, use the output buffer as the new input buffer
 	std::swap(cellSSBO[0], cellSSBO[1]);
+	std::swap(brickFlagSSBO[0], brickFlagSSBO[1]);
+	// The masks describe the input, which is now cellSSBO[1]
+	faceMasksValid = faceMasks;
+}
+
+void CellRulesShader::simulateSeparable()
+{
+	// Every cell is simulated, so the brick flags of the future state are set from scratch
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickFlagSSBO[1]);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cellSSBO[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cellSSBO[1]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, brickFlagSSBO[1]);
+	if (useRuleTable)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ruleTableSSBO);
+	if (trackStates)
+		bindStateHashSlot(6);
+
+	// One invocation per row of cells along x, then per column of words along y, then along z
+	const int numInvocations[3] = { height * depth, width / 4 * depth, width / 4 * height };
+	for (int pass = 0; pass < 3; pass++)
+	{
+		// Each pass reads the box sums of the previous pass
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, pass > 0 ? boxSumSSBO[pass - 1] : 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, pass < 2 ? boxSumSSBO[pass] : 0);
+		glUseProgram(separablePrograms[pass]);
+		// Only the last pass writes the cells, and their hash
+		if (trackStates && pass == 2)
+			glUniform1ui(0, pendingHashes.back().slot);
+		glDispatchCompute((numInvocations[pass] + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	glUseProgram(0);
+	if (trackStates)
+		fenceStateHashSlot();
+
+	for (int i = 0; i < 7; i++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+
+	std::swap(cellSSBO[0], cellSSBO[1]);
+	std::swap(brickFlagSSBO[0], brickFlagSSBO[1]);
+	// The separable shader doesn't write face masks
+	faceMasksValid = false;
+}
+
+uint64_t CellRulesShader::getGeneration()
+{
+	return generation;
 }
 
 GLuint CellRulesShader::getCellSSBO()
 {
+	syncCPUCellSSBO();
 	return cellSSBO[0];
 }
 
+GLuint CellRulesShader::getBrickFlagSSBO()
+{
+	syncCPUCellSSBO();
+	return brickFlagSSBO[0];
+}
+
+void CellRulesShader::setTileSize(int tileSize)
+{
+	if (tileSize < 0 || tileSize % 4 != 0 || (tileSize != 0 && BRICK_SIZE % tileSize != 0))
+		throw std::invalid_argument("CellRulesShader: tile size must be 0 or a multiple of 4 that divides " + std::to_string(BRICK_SIZE));
+	if (tileSize == this->tileSize)
+		return;
+	this->tileSize = tileSize;
+	rebuildRulePrograms();
+}
+
+int CellRulesShader::getTileSize()
+{
+	return tileSize;
+}
+
+void CellRulesShader::setUseRuleTable(bool useRuleTable)
+{
+	if (useRuleTable == this->useRuleTable)
+		return;
+	this->useRuleTable = useRuleTable;
+	rebuildRulePrograms();
+}
+
+bool CellRulesShader::getUseRuleTable()
+{
+	return useRuleTable;
+}
+
+void CellRulesShader::setTrackStates(bool trackStates)
+{
+	if (trackStates == this->trackStates)
+		return;
+	this->trackStates = trackStates;
+	resetStateHistory();
+	if (cpuRules != nullptr)
+		return;
+
+	if (stateHashSSBO == 0)
+	{
+		const GLsizeiptr size = sizeof(GLuint) * 2 * NUM_HASH_SLOTS;
+		glGenBuffers(1, &stateHashSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateHashSSBO);
+		if (GLEW_ARB_buffer_storage)
+		{
+			// Coherent, so the hashes can be read as soon as their fence has signaled
+			GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr, flags);
+			stateHashData = static_cast<const GLuint*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, flags));
+		}
+		else
+		{
+			glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_READ);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	rebuildRulePrograms();
+}
+
+bool CellRulesShader::getTrackStates()
+{
+	return trackStates;
+}
+
+StateHistory::SteadyState CellRulesShader::getSteadyState()
+{
+	while (readStateHash(false));
+	return stateHistory.getSteadyState();
+}
+
+StateHistory& CellRulesShader::finishStateHashes()
+{
+	while (readStateHash(true));
+	return stateHistory;
+}
+
+void CellRulesShader::resetStateHistory()
+{
+	// Hashes still in flight belong to the old cells, so they are dropped
+	for (const PendingHash& pendingHash : pendingHashes)
+		glDeleteSync(pendingHash.fence);
+	pendingHashes.clear();
+	stateHistory.clear();
+}
+
+void CellRulesShader::bindStateHashSlot(GLuint binding)
+{
+	// Every slot is in flight, so wait for the oldest one
+	if (pendingHashes.size() == NUM_HASH_SLOTS)
+		readStateHash(true);
+
+	int slot = static_cast<int>(generation % NUM_HASH_SLOTS);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateHashSSBO);
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_RG32UI, sizeof(GLuint) * 2 * slot, sizeof(GLuint) * 2, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, stateHashSSBO);
+	pendingHashes.push_back(PendingHash{ generation, slot, 0 });
+}
+
+void CellRulesShader::fenceStateHashSlot()
+{
+	// Shader writes to a persistently mapped buffer must be made visible to the client before the fence
+	if (stateHashData != nullptr)
+		glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	pendingHashes.back().fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool CellRulesShader::readStateHash(bool wait)
+{
+	if (pendingHashes.empty())
+		return false;
+	PendingHash& pendingHash = pendingHashes.front();
+	if (!wait && glClientWaitSync(pendingHash.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		return false;
+	waitFence(pendingHash.fence);
+
+	GLuint hash[2];
+	if (stateHashData != nullptr)
+	{
+		hash[0] = stateHashData[2 * pendingHash.slot];
+		hash[1] = stateHashData[2 * pendingHash.slot + 1];
+	}
+	else
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateHashSSBO);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * pendingHash.slot, sizeof(hash), hash);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	stateHistory.add(pendingHash.generation, static_cast<uint64_t>(hash[1]) << 32 | hash[0]);
+	pendingHashes.pop_front();
+	return true;
+}
+
+bool CellRulesShader::isRuleChangePending()
+{
+	return pendingRule.isValid();
+}
+
+void CellRulesShader::finishRuleChange()
+{
+	if (!pendingRule.isValid())
+		return;
+
+	if (pendingComputeProgram != 0)
+		finishComputeProgram(pendingComputeProgram, "CellRulesShader");
+	for (int i = 0; i < 3; i++)
+	{
+		if (pendingSeparablePrograms[i] != 0)
+			finishComputeProgram(pendingSeparablePrograms[i], "CellRulesShader separable pass " + std::to_string(i));
+	}
+
+	deleteRulePrograms();
+	computeProgram = pendingComputeProgram;
+	pendingComputeProgram = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		separablePrograms[i] = pendingSeparablePrograms[i];
+		pendingSeparablePrograms[i] = 0;
+	}
+	if (pendingRule.isSeparable() && boxSumSSBO[0] == 0)
+	{
+		// The first 2 passes of the separable shader write box sums of 1 byte per cell
+		glGenBuffers(2, boxSumSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, boxSumSSBO[0]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(paddedCellsSize), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, boxSumSSBO[1]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(paddedCellsSize), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	if (useRuleTable)
+		uploadRuleTable(pendingRule);
+	cellRule = pendingRule;
+	pendingRule = CellRule();
+	resetStateHistory();
+}
+
+void CellRulesShader::startPendingRule(const CellRule& newRule)
+{
+	pendingRule = newRule;
+	if (newRule.isSeparable())
+		startSeparablePrograms(newRule, pendingSeparablePrograms);
+	else
+		pendingComputeProgram = startRulesProgram(newRule);
+}
+
+bool CellRulesShader::isPendingRuleReady()
+{
+	if (pendingComputeProgram != 0 && !isComputeProgramReady(pendingComputeProgram))
+		return false;
+	for (int i = 0; i < 3; i++)
+	{
+		if (pendingSeparablePrograms[i] != 0 && !isComputeProgramReady(pendingSeparablePrograms[i]))
+			return false;
+	}
+	return true;
+}
+
+void CellRulesShader::discardPendingRule()
+{
+	if (pendingComputeProgram != 0)
+		glDeleteProgram(pendingComputeProgram);
+	for (int i = 0; i < 3; i++)
+	{
+		if (pendingSeparablePrograms[i] != 0)
+			glDeleteProgram(pendingSeparablePrograms[i]);
+		pendingSeparablePrograms[i] = 0;
+	}
+	pendingComputeProgram = 0;
+	pendingRule = CellRule();
+}
+
+void CellRulesShader::deleteRulePrograms()
+{
+	if (computeProgram != 0)
+		glDeleteProgram(computeProgram);
+	for (int i = 0; i < 3; i++)
+	{
+		if (separablePrograms[i] != 0)
+			glDeleteProgram(separablePrograms[i]);
+		separablePrograms[i] = 0;
+	}
+	computeProgram = 0;
+}
+
+void CellRulesShader::rebuildRulePrograms()
+{
+	if (cpuRules != nullptr || !cellRule.isValid())
+		return;
+
+	// The current rule is rebuilt right away, a pending rule goes on compiling in the background
+	CellRule nextRule = pendingRule;
+	discardPendingRule();
+	startPendingRule(cellRule);
+	finishRuleChange();
+	if (nextRule.isValid())
+		startPendingRule(nextRule);
+}
+
+void CellRulesShader::uploadRuleTable(const CellRule& newRule)
+{
+	// Refractory states don't depend on the neighbors, so only dead and live cells need a row of the table
+	const int numCounts = newRule.getMaxNeighbors() + 1;
+	const GLuint dieState = newRule.getNumStates() > 2 ? newRule.getNumStates() - 1 : 0;
+	std::vector<GLuint> table(2 * numCounts);
+	for (int n = 0; n < numCounts; n++)
+	{
+		table[n] = newRule.isBorn(n) ? 1 : 0;
+		table[numCounts + n] = newRule.staysAlive(n) ? 1 : dieState;
+	}
+
+	if (ruleTableSSBO == 0)
+		glGenBuffers(1, &ruleTableSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ruleTableSSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * static_cast<GLsizeiptr>(table.size()), table.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GLuint CellRulesShader::getFaceMaskSSBO()
+{
+	return faceMaskSSBO;
+}
+
+GLuint CellRulesShader::getFaceCountSSBO()
+{
+	return faceCountSSBO;
+}
+
+GLuint CellRulesShader::getFaceMaskCellSSBO()
+{
+	return faceMasksValid ? cellSSBO[1] : 0;
+}
+
+CellRulesShader::Engine CellRulesShader::getEngine()
+{
+	return engine;
+}
+
 int CellRulesShader::getWidth()
 {
 	return width;
@@ -441,27 +1643,95 @@ int CellRulesShader::getDepth()
 	return depth;
 }
 
-bool CellRulesShader::hasRuleFlagStayAliveBit(uint64_t flags, int flagBit)
+void CellRulesShader::syncCPUCellSSBO()
 {
-	return (flags >> (flagBit + 27)) & 1;
-}
+	if (cpuRules == nullptr || !cellSSBOOutdated)
+		return;
 
-bool CellRulesShader::hasRuleFlagBornBit(uint64_t flags, int flagBit)
-{
-	return (flags >> flagBit) & 1;
+	// The CPU engines only need a single buffer, which is just a copy of their current state for the meshing shader.
+	cpuRules->getCells(cells);
+	if (cellSSBO[0] == 0)
+	{
+		glGenBuffers(1, &cellSSBO[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellSSBO[0]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(paddedCellsSize), nullptr, GL_DYNAMIC_DRAW);
+		glGenBuffers(1, &brickFlagSSBO[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickFlagSSBO[0]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * static_cast<GLsizeiptr>(numBricks), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	transfer.upload(cellSSBO[0], 0, paddedCellsSize, cells);
+	uploadBrickFlags(0, bricksZ - 1);
+	cellSSBOOutdated = false;
 }
 
-int CellRulesShader::getNumStates(uint64_t flags)
+void CellRulesShader::uploadBrickFlags(int firstBrickZ, int lastBrickZ)
 {
-	return (flags >> 54) & 511;
+	// Flag every brick which contains at least one non-zero cell of the CPU side cell buffer
+	int brickLayerSize = bricksX * bricksY;
+	std::vector<GLuint> brickFlags((lastBrickZ - firstBrickZ + 1) * brickLayerSize, 0);
+	for (int z = firstBrickZ * BRICK_SIZE; z < std::min((lastBrickZ + 1) * BRICK_SIZE, depth); z++)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			const uint8_t* row = cells + y * width + z * width * height;
+			GLuint* brickRow = brickFlags.data() + (y / BRICK_SIZE) * bricksX + (z / BRICK_SIZE - firstBrickZ) * brickLayerSize;
+			for (int x = 0; x < width; x++)
+			{
+				if (row[x] != 0)
+					brickRow[x / BRICK_SIZE] = 1;
+			}
+		}
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickFlagSSBO[0]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * firstBrickZ * brickLayerSize, sizeof(GLuint) * brickFlags.size(), brickFlags.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 void CellRulesShader::cleanup()
 {
-	if (ruleFlags != 0)
+	delete[] cells;
+	cells = nullptr;
+	// The CPU engine may never have created any OpenGL objects, and may not even have an OpenGL context
+	if (brickListProgram != 0)
+	{
+		discardPendingRule();
+		deleteRulePrograms();
+		glDeleteProgram(brickListProgram);
+		glDeleteProgram(seedProgram);
+		glDeleteBuffers(1, &brickListBuffer);
+	}
+	if (boxSumSSBO[0] != 0)
+		glDeleteBuffers(2, boxSumSSBO);
+	if (faceMaskSSBO != 0)
+	{
+		glDeleteBuffers(1, &faceMaskSSBO);
+		glDeleteBuffers(1, &faceCountSSBO);
+	}
+	if (ruleTableSSBO != 0)
+		glDeleteBuffers(1, &ruleTableSSBO);
+	resetStateHistory();
+	// Deleting a buffer also unmaps it
+	if (stateHashSSBO != 0)
+		glDeleteBuffers(1, &stateHashSSBO);
+	if (cellSSBO[0] != 0 || cellSSBO[1] != 0)
 	{
-		delete[] cells;
-		glDeleteProgram(computeProgram);
 		glDeleteBuffers(2, cellSSBO);
+		glDeleteBuffers(2, brickFlagSSBO);
 	}
+	brickListProgram = 0;
+	seedProgram = 0;
+	brickListBuffer = 0;
+	cellSSBO[0] = 0;
+	cellSSBO[1] = 0;
+	brickFlagSSBO[0] = 0;
+	brickFlagSSBO[1] = 0;
+	faceMaskSSBO = 0;
+	faceCountSSBO = 0;
+	ruleTableSSBO = 0;
+	stateHashSSBO = 0;
+	stateHashData = nullptr;
+	boxSumSSBO[0] = 0;
+	boxSumSSBO[1] = 0;
 }
@@ -8,19 +8,45 @@
 #include <algorithm>
 #include <stdexcept>
 #include <vector>
+#include <deque>
 #include <iostream>
 
 #include "Util.h"
+#include "CellRule.h"
+#include "CellRulesCPU.h"
+#include "GPUTransfer.h"
+#include "Automaton.h"
+#include "StateHistory.h"
 
 class CellRulesShader
 {
 public:
-	CellRulesShader(int width, int height, int depth, std::string rule);
+	/* GPU runs the rules as a compute shader. CPU runs the same rules on a thread pool (see CellRulesCPU) and only
+	   touches OpenGL if getCellSSBO() is called, so it also works without a GPU or OpenGL context. CPUBitplane is the
+	   CPU engine using packed alive bits and bit-sliced neighbor counting, which is much faster on large grids.
+	   CPUUnbounded simulates an infinite grid on the CPU, and the width x height x depth grid is a window onto it.
+	   CPUHashLife does the same with a memoized octree, which can jump far ahead in time with simulate(generations). */
+	enum class Engine
+	{
+		GPU,
+		CPU,
+		CPUBitplane,
+		CPUUnbounded,
+		CPUHashLife
+	};
+
+	/* With faceMasks the GPU engine also writes the visible sides of every cell while simulating, see
+	   getFaceMaskSSBO(). The other engines ignore it. */
+	CellRulesShader(int width, int height, int depth, std::string rule, Engine engine = Engine::GPU, bool faceMasks = false);
+
+	/* The grid is divided into bricks of BRICK_SIZE^3 cells. The GPU engine only simulates bricks which contain
+	   non-zero cells or are next to a brick which does, so mostly empty grids are much cheaper to simulate. */
+	static const int BRICK_SIZE = 8;
 	virtual ~CellRulesShader();
 
 	/* The rule determines how the automaton will behave. The format is:   B <numbers> / S <numbers> / <states>
-   where <numbers> is a comma separated list of numbers between 0 and 26 inclusive. Each number between 0 and 26
-   can either appear once or not appear at all. The <numbers> after B determine the number of cells a dead cell must be
+   where <numbers> is a comma separated list of numbers between 0 and 26 inclusive, or ranges of them like 4-6.
+   Each number between 0 and 26 can either appear once or not appear at all. The <numbers> after B determine the number of cells a dead cell must be
    surrounded by to be reborn, and the <numbers> after S determine the number of cells a living cell must be surrounded
    by to survive until the next iteration. <states> represents the refractory period, which is at least 2. 2 includes
    the dead and alive states. Any number N large than 2 will provide the automaton with N-2 additional "dead" states
@@ -28,40 +54,209 @@ public:
    Example rule: B 2 / S 2,3 / 5 = dead cell comes to life when it has 2 live neighbors, living cell stays alive only if
    it has 2 or 3 live neighbors, there are 3 extra states a cell cycles through after it dies before it is ready to become
    a true dead cell. Once it is a true dead cell, it can be reborn in the next iteration. That is a total of 4 unalive states.
-   The rule string may omit the second '/' and <states> for a default of 2 states (dead or alive). */
+   The rule string may omit the second '/' and <states> for a default of 2 states (dead or alive).
+   A fourth field M<radius> counts the live cells within a larger cube of (2 radius + 1)^3 cells, for example
+   B 40-60 / S 30-70 / 5 / M3, and the numbers can then go up to the number of cells in the cube minus 1 (see CellRule).
+   These neighbors are counted with separable running sums along each axis, which costs the same for every radius.
+   Instead of M<radius> the fourth field may be N for the 6 face neighbors, E for the 18 face and edge neighbors, or
+   K followed by a 3x3x3 or 5x5x5 mask of weights (see CellRule). The neighbor counting code is generated from the
+   neighborhood, so neighbors outside of it are never read or added.
+   Only the GPU and CPU engines support neighborhoods other than M1, setRule() throws std::invalid_argument for the others.
+   An invalid rule string is ignored.
+   The cells are kept, so the new rule carries on from the current state, and getGeneration() doesn't change. The GPU
+   engine compiles the shaders of the new rule in the background (with GL_KHR_parallel_shader_compile) and goes on
+   simulating with the old rule until they are ready, so setRule() doesn't stall while the world is running.
+   finishRuleChange() waits for them. With a rule table and the same neighborhood there is nothing to compile, see
+   setUseRuleTable(). */
 	void setRule(std::string rule);
-	// Convert rule back to string
+	// Convert the last rule set back to a string, even if its shaders are still compiling
 	std::string getRule();
+	// Whether the GPU engine is still simulating the previous rule while the shaders of the last one compile
+	bool isRuleChangePending();
+	// Wait for the shaders of the last rule set and switch to them
+	void finishRuleChange();
 
 	// Get cells pointer (CPU side)
-	uint32_t* getCells();
-	// Update CPU side cells pointer with GPU data
+	uint8_t* getCells();
+	/* Update GPU data with CPU side cells pointer. The GPU engine copies the cells through a persistently mapped ring
+	   buffer (see GPUTransfer), so the cell buffer is never reallocated. */
 	void updateGPUCells();
-	// Update GPU data with CPU side cells pointer
+	/* Only update the slices firstZ to lastZ, widened to whole bricks, for changes to a small part of the grid. The
+	   cells outside of those bricks are left alone, so they don't need to be up to date on the CPU side. */
+	void updateGPUCells(int firstZ, int lastZ);
+	// Update CPU side cells pointer with GPU data, waiting for the GPU to finish all queued work
 	void fetchGPUCells();
+	/* fetchGPUCells() without the wait: the GPU engine copies its cells to a staging buffer after the work queued so far,
+	   and readRequestedGPUCells() copies them to the CPU side cells once that is done, usually a frame or two later.
+	   The cells are then those of the generation at the time of requestGPUCells(). */
+	void requestGPUCells();
+	/* Returns false without waiting if the requested cells haven't arrived yet or none were requested. The CPU engines
+	   have their cells at hand, so they always read the current ones and return true. */
+	bool readRequestedGPUCells();
+	/* Add the cells of a seed to the current cells, with the random numbers of the key (see CubeSeed), so a key gives
+	   the same cells on every engine. The GPU engine fills its cell buffer with a compute shader, without a round trip
+	   through the CPU side cells. The CPU engines fill their cells on their thread pool. */
+	void seedCells(CubeSeed seed, uint32_t key);
 	// Simulate GPU primary cell buffer using rules, and store result in secondary CPU cell buffer
 	void simulate();
+	// Simulate many timesteps at once. The CPUHashLife engine jumps ahead in far less time than simulating each step.
+	void simulate(uint64_t generations);
+	/* Counts every change of the cells: each simulated generation, updateGPUCells() and seedCells(). setRule() keeps the
+	   cells, so it doesn't count. Anything derived from the cells, like the mesh, is still valid while this stays the same. */
+	uint64_t getGeneration();
+	// With the CPU engine, this uploads the current state to the GPU first if it changed since the last call
 	GLuint getCellSSBO();
+	/* One uint per brick of BRICK_SIZE^3 cells, non-zero if the brick contains any non-zero cells in getCellSSBO().
+	   Bricks are numbered x first, then y, then z, just like cells. */
+	GLuint getBrickFlagSSBO();
+	/* Face masks of the cells in getFaceMaskCellSSBO(), 1 byte per cell packed like the cells. Bits 0 to 5 are set
+	   when the left, right, bottom, top, back and front side of a non-zero cell is visible, which is when the neighbor
+	   on that side is 0 or outside of the grid. The rules shader already reads those neighbors to simulate, so this
+	   saves the mesher from reading them again. */
+	GLuint getFaceMaskSSBO();
+	// One uint per brick, the number of visible faces of the brick in getFaceMaskCellSSBO()
+	GLuint getFaceCountSSBO();
+	/* The cell buffer the face masks were computed from, which is the previous generation, since the rules shader
+	   masks its input. 0 if there are no valid masks: without faceMasks, with a CPU engine, or when the cells were
+	   changed without simulating. */
+	GLuint getFaceMaskCellSSBO();
+	/* The GPU rules shader can load each brick into shared memory in tiles of tileSize^3 cells (plus a border of
+	   neighbors), and count the neighbors from there instead of reading every word from the cell buffer 27 times.
+	   tileSize must be 0 (no tiles, the default) or a multiple of 4 that divides BRICK_SIZE. The shader is rebuilt
+	   without touching the cells. */
+	void setTileSize(int tileSize);
+	int getTileSize();
+	/* With a rule table the GPU rules shaders look up the next state of dead and live cells by their neighbor count in a
+	   small buffer, instead of testing the B and S counts in generated code, so the shaders only depend on the
+	   neighborhood. setRule() to another rule with the same neighborhood then just uploads a new table, which takes
+	   effect right away and keeps the cells like any other rule change, instead of compiling new shaders in the
+	   background, which matters when sweeping through many rules. The shaders are rebuilt without touching the cells.
+	   The CPU engines always use lookup tables and ignore this. */
+	void setUseRuleTable(bool useRuleTable);
+	bool getUseRuleTable();
+	/* With trackStates every simulated generation is hashed into a StateHistory, which finds out when the automaton
+	   dies out, stops changing or cycles. The GPU rules shaders XOR the hashes of the words they write in shared memory
+	   and add one hash per brick to a small ring buffer, which is read back once the fence of its generation has
+	   signaled, so the hashes arrive a few generations late but never stall the GPU. The CPU engines hash their own
+	   cells after each generation with CellRulesCPU::hashState(), and CPUUnbounded and CPUHashLife hash their whole
+	   infinite grid, so cells that leave the window still count. Changing the cells any other way, or the rule, starts
+	   a new history.
+	   The GPU shaders are rebuilt without touching the cells. */
+	void setTrackStates(bool trackStates);
+	bool getTrackStates();
+	// The steady state found so far in the hashes that have arrived, see StateHistory. Never waits for the GPU.
+	StateHistory::SteadyState getSteadyState();
+	// Wait for the hashes of every generation simulated so far, then return the history they were added to
+	StateHistory& finishStateHashes();
+	Engine getEngine();
 
 	int getWidth();
 	int getHeight();
 	int getDepth();
 private:
-	// First 27 bits are B (born) rules, second 27 bits are S (stay alive) rules, next 9 bits are number of refractory states, last bit is whether this rule is set or not.
-	uint64_t ruleFlags;
-	bool hasRuleFlagStayAliveBit(uint64_t flags, int flagBit);
-	bool hasRuleFlagBornBit(uint64_t flags, int flagBit);
-	int getNumStates(uint64_t flags);
+	// The rule the shaders simulate, invalid until the first valid rule is set
+	CellRule cellRule;
+	// The rule whose shaders are compiling, invalid if there is none
+	CellRule pendingRule;
 	void cleanup();
+	// Create the cell buffers, brick buffers and the brick list shader, which don't depend on the rule
+	void createGPUResources();
+	// Upload the CPU engine state to the cell SSBO if it changed
+	void syncCPUCellSSBO();
+	// Compute the brick flags of layers firstBrickZ to lastBrickZ of the CPU side cell buffer and upload them to brickFlagSSBO[0]
+	void uploadBrickFlags(int firstBrickZ, int lastBrickZ);
+	// Generate the rules compute shader for the rule and start compiling it, see setRule()
+	GLuint startRulesProgram(const CellRule& newRule);
+	// Generate the 3 passes of the separable rules shader and start compiling them, used for Moore neighborhoods with radius > 1
+	void startSeparablePrograms(const CellRule& newRule, GLuint programs[3]);
+	// Start compiling the shaders of newRule as the pending rule
+	void startPendingRule(const CellRule& newRule);
+	// Whether the driver has finished compiling the shaders of the pending rule
+	bool isPendingRuleReady();
+	void discardPendingRule();
+	void deleteRulePrograms();
+	// Rebuild the shaders of the current and pending rule after a setting they depend on changed
+	void rebuildRulePrograms();
+	// Simulate one step of a separable rule with the separable passes
+	void simulateSeparable();
+	// Fill ruleTableSSBO with the next states of newRule, creating it if needed
+	void uploadRuleTable(const CellRule& newRule);
+	// Forget the state hashes, including those still on their way from the GPU
+	void resetStateHistory();
+	// Clear the hash slot of the generation about to be simulated and bind it to the binding point of the rules shader
+	void bindStateHashSlot(GLuint binding);
+	// Fence the hash written by the rules shader, after its dispatch
+	void fenceStateHashSlot();
+	/* Add the hash of the oldest generation in flight to stateHistory. Returns false if there is none, or its fence
+	   hasn't signaled yet and wait is false. */
+	bool readStateHash(bool wait);
+
+	Engine engine;
+	// Only used by the CPU engines
+	CellRulesCPU* cpuRules;
+	// True when the CPU engine state has changed since it was last uploaded to cellSSBO[0]
+	bool cellSSBOOutdated;
+	uint64_t generation;
 
 	int width, height, depth;
 	int cellsSize;
-	// This is the local cell buffer, which we update on the CPU side when we want to change cells
-	uint32_t* cells;
+	int paddedCellsSize;
+	// This is the local cell buffer, which we update on the CPU side when we want to change cells. Each cell is 1 byte.
+	uint8_t* cells;
 	/* These are the GPU cell buffers, which we only update after we change the CPU side buffer(seldom).
 	   We can also fetch the GPU cell buffer and store it in the "cells" member variable using fetchGPUCells(). */
 	GLuint cellSSBO[2];
 	GLuint computeProgram;
+	// Uploads to and readbacks from cellSSBO[0]
+	GPUTransfer transfer;
+
+	int bricksX, bricksY, bricksZ;
+	int numBricks;
+	// Brick flags of the matching cell buffers
+	GLuint brickFlagSSBO[2];
+	// Indirect dispatch group counts followed by the list of bricks to simulate
+	GLuint brickListBuffer;
+	GLuint brickListProgram;
+	// Fills a CubeSeed into cellSSBO[0] and flags its bricks, see seedCells()
+	GLuint seedProgram;
+	GLint seedBeginUniformLocation;
+	GLint seedEndUniformLocation;
+	GLint seedDensityUniformLocation;
+	GLint seedKeyUniformLocation;
+
+	bool faceMasks;
+	int tileSize;
+	bool useRuleTable;
+	// Only used with useRuleTable, 2 * (CellRule::getMaxNeighbors() + 1) uints
+	GLuint ruleTableSSBO;
+	// Shaders of pendingRule, 0 until setRule() starts compiling them
+	GLuint pendingComputeProgram;
+	GLuint pendingSeparablePrograms[3];
+
+	/* Passes of the separable rules shader: live cells within the radius along x, then the sums of those along y, then
+	   along z, which gives the neighbor counts the rule is applied to. Only created for rules with radius > 1. */
+	GLuint separablePrograms[3];
+	// Output of the first 2 passes, 1 byte per cell packed like the cells
+	GLuint boxSumSSBO[2];
+	// Written by the rules shader from cellSSBO[1] (after the swap) when faceMasksValid
+	GLuint faceMaskSSBO;
+	GLuint faceCountSSBO;
+	bool faceMasksValid;
+
+	bool trackStates;
+	StateHistory stateHistory;
+	// Generations whose hash the GPU may still be writing, there is one slot for each in stateHashSSBO
+	static const int NUM_HASH_SLOTS = 64;
+	struct PendingHash
+	{
+		uint64_t generation;
+		int slot;
+		GLsync fence;
+	};
+	std::deque<PendingHash> pendingHashes;
+	// NUM_HASH_SLOTS hashes of 2 uints, low half first. Persistently mapped to stateHashData with GL_ARB_buffer_storage.
+	GLuint stateHashSSBO;
+	const GLuint* stateHashData;
 };
 
 #endif // CELL_RULES_SHADER_H
@@ -0,0 +1,177 @@
+#include "FrameProfiler.h"
+
+FrameProfiler::FrameProfiler(int historySize)
+{
+	this->historySize = historySize;
+	for (int i = 0; i < QUERY_RING_SIZE; i++)
+		queryFrames[i].used = 0;
+	currentQueryFrame = 0;
+	currentStage = -1;
+	frameNext = 0;
+	droppedFrames = 0;
+	frameStartTime = std::chrono::high_resolution_clock::now();
+}
+
+FrameProfiler::~FrameProfiler()
+{
+	for (int i = 0; i < QUERY_RING_SIZE; i++)
+	{
+		if (!queryFrames[i].queries.empty())
+			glDeleteQueries(static_cast<GLsizei>(queryFrames[i].queries.size()), queryFrames[i].queries.data());
+	}
+}
+
+void FrameProfiler::beginStage(const std::string& name)
+{
+	currentStage = getStageIndex(name);
+
+	QueryFrame& frame = queryFrames[currentQueryFrame];
+	if (frame.used == static_cast<int>(frame.queries.size()))
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+		frame.queryStages.push_back(0);
+	}
+	frame.queryStages[frame.used] = currentStage;
+	glBeginQuery(GL_TIME_ELAPSED, frame.queries[frame.used]);
+	frame.used++;
+
+	stageStartTime = std::chrono::high_resolution_clock::now();
+}
+
+void FrameProfiler::endStage()
+{
+	if (currentStage < 0)
+		return;
+	auto endTime = std::chrono::high_resolution_clock::now();
+	glEndQuery(GL_TIME_ELAPSED);
+
+	Stage& stage = stages[currentStage];
+	stage.cpuTime += std::chrono::duration<double, std::milli>(endTime - stageStartTime).count();
+	stage.ran = true;
+	currentStage = -1;
+}
+
+void FrameProfiler::endFrame()
+{
+	auto now = std::chrono::high_resolution_clock::now();
+	addSample(frameHistory, frameNext, std::chrono::duration<double, std::milli>(now - frameStartTime).count());
+	frameStartTime = now;
+
+	for (Stage& stage : stages)
+	{
+		if (stage.ran)
+			addSample(stage.cpuHistory, stage.cpuNext, stage.cpuTime);
+		stage.cpuTime = 0.0;
+		stage.ran = false;
+	}
+
+	// The oldest frame in the ring is reused next, so its queries have had QUERY_RING_SIZE - 1 frames to finish
+	currentQueryFrame = (currentQueryFrame + 1) % QUERY_RING_SIZE;
+	collectQueryFrame(queryFrames[currentQueryFrame]);
+}
+
+std::string FrameProfiler::getReport()
+{
+	std::ostringstream output;
+	output << std::fixed << std::setprecision(2);
+	output << "frame ";
+	writeStatistics(output, frameHistory);
+	double frameTotal = 0.0;
+	for (double time : frameHistory)
+		frameTotal += time;
+	if (frameTotal > 0.0)
+		output << " ms (" << static_cast<int>(1000.0 * frameHistory.size() / frameTotal) << " fps)";
+	for (const Stage& stage : stages)
+	{
+		output << " | " << stage.name << " cpu ";
+		writeStatistics(output, stage.cpuHistory);
+		output << " gpu ";
+		writeStatistics(output, stage.gpuHistory);
+	}
+	output << " | min/avg/p99 ms over " << frameHistory.size() << " frames";
+	if (droppedFrames > 0)
+		output << ", " << droppedFrames << " GPU samples dropped";
+	return output.str();
+}
+
+int FrameProfiler::getStageIndex(const std::string& name)
+{
+	for (int i = 0; i < static_cast<int>(stages.size()); i++)
+	{
+		if (stages[i].name == name)
+			return i;
+	}
+
+	Stage stage;
+	stage.name = name;
+	stage.cpuNext = 0;
+	stage.gpuNext = 0;
+	stage.cpuTime = 0.0;
+	stage.ran = false;
+	stages.push_back(stage);
+	return static_cast<int>(stages.size()) - 1;
+}
+
+void FrameProfiler::addSample(std::vector<double>& history, int& next, double value)
+{
+	if (static_cast<int>(history.size()) < historySize)
+	{
+		history.push_back(value);
+		return;
+	}
+	history[next] = value;
+	next = (next + 1) % historySize;
+}
+
+void FrameProfiler::writeStatistics(std::ostringstream& output, const std::vector<double>& history)
+{
+	if (history.empty())
+	{
+		output << "-/-/-";
+		return;
+	}
+	std::vector<double> sorted = history;
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0.0;
+	for (double time : sorted)
+		total += time;
+	size_t p99Index = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+	output << sorted.front() << "/" << total / sorted.size() << "/" << sorted[p99Index];
+}
+
+void FrameProfiler::collectQueryFrame(QueryFrame& frame)
+{
+	if (frame.used == 0)
+		return;
+
+	// Reading a result that isn't available yet would stall, so drop the whole frame instead
+	for (int i = 0; i < frame.used; i++)
+	{
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+		{
+			droppedFrames++;
+			frame.used = 0;
+			return;
+		}
+	}
+
+	std::vector<double> gpuTimes(stages.size(), 0.0);
+	std::vector<bool> ran(stages.size(), false);
+	for (int i = 0; i < frame.used; i++)
+	{
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &nanoseconds);
+		gpuTimes[frame.queryStages[i]] += nanoseconds / 1.0e6;
+		ran[frame.queryStages[i]] = true;
+	}
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		if (ran[i])
+			addSample(stages[i].gpuHistory, stages[i].gpuNext, gpuTimes[i]);
+	}
+	frame.used = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef FRAME_PROFILER_H
+#define FRAME_PROFILER_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+/* Measures how long each stage of a frame takes, both on the CPU (time spent issuing the work) and on the GPU (with
+   GL_TIME_ELAPSED queries). GPU results are read back QUERY_RING_SIZE frames later, when they are long finished, so the
+   profiler never makes the CPU wait for the GPU. The last historySize frames of each stage are kept to report rolling
+   min/avg/p99 times. */
+class FrameProfiler
+{
+public:
+	FrameProfiler(int historySize = 240);
+	virtual ~FrameProfiler();
+
+	/* Start timing a stage. Timer queries can't overlap, so only one stage can be timed at a time. The same stage can be
+	   timed several times per frame (e.g. once per meshing stage) and the times are added up. */
+	void beginStage(const std::string& name);
+	void endStage();
+	// Finish the current frame and collect the GPU times of older frames
+	void endFrame();
+	/* One line with the rolling min/avg/p99 frame time and CPU/GPU time of every stage in milliseconds, for example
+	   "frame 16.70/16.90/18.20 ms (59 fps) | simulate cpu 0.02/0.03/0.09 gpu 1.10/1.20/1.90 | ..." */
+	std::string getReport();
+private:
+	static const int QUERY_RING_SIZE = 4;
+
+	struct Stage
+	{
+		std::string name;
+		// Rolling history of per-frame times in milliseconds, next points at the oldest entry once the history is full
+		std::vector<double> cpuHistory;
+		std::vector<double> gpuHistory;
+		int cpuNext;
+		int gpuNext;
+		// Time of the current frame so far, and whether the stage ran at all this frame
+		double cpuTime;
+		bool ran;
+	};
+	struct QueryFrame
+	{
+		// Query objects are reused from frame to frame, used is the number issued in this frame
+		std::vector<GLuint> queries;
+		std::vector<int> queryStages;
+		int used;
+	};
+
+	int getStageIndex(const std::string& name);
+	void addSample(std::vector<double>& history, int& next, double value);
+	// Write "min/avg/p99" of a history
+	static void writeStatistics(std::ostringstream& output, const std::vector<double>& history);
+	// Read back the GPU times of a frame in the ring if they are available, otherwise drop them
+	void collectQueryFrame(QueryFrame& frame);
+
+	int historySize;
+	std::vector<Stage> stages;
+	QueryFrame queryFrames[QUERY_RING_SIZE];
+	int currentQueryFrame;
+	int currentStage;
+	std::chrono::high_resolution_clock::time_point stageStartTime;
+	std::chrono::high_resolution_clock::time_point frameStartTime;
+	std::vector<double> frameHistory;
+	int frameNext;
+	// Frames whose GPU times weren't ready after QUERY_RING_SIZE frames and were dropped
+	int droppedFrames;
+};
+
+#endif // FRAME_PROFILER_H
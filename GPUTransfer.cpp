@@ -0,0 +1,142 @@
+#include "GPUTransfer.h"
+#include "Util.h"
+
+GPUTransfer::GPUTransfer()
+{
+	uploadRing = 0;
+	uploadRingData = nullptr;
+	for (int i = 0; i < NUM_SEGMENTS; i++)
+		segmentFences[i] = 0;
+	nextSegment = 0;
+	readbackBuffer = 0;
+	readbackCapacity = 0;
+	readbackSize = 0;
+	readbackData = nullptr;
+	readbackFence = 0;
+}
+
+GPUTransfer::~GPUTransfer()
+{
+	for (int i = 0; i < NUM_SEGMENTS; i++)
+	{
+		if (segmentFences[i] != 0)
+			glDeleteSync(segmentFences[i]);
+	}
+	if (readbackFence != 0)
+		glDeleteSync(readbackFence);
+	// Deleting a buffer also unmaps it
+	if (uploadRing != 0)
+		glDeleteBuffers(1, &uploadRing);
+	if (readbackBuffer != 0)
+		glDeleteBuffers(1, &readbackBuffer);
+}
+
+void GPUTransfer::createUploadRing()
+{
+	// Coherent, so the writes are visible to the copies without flushing
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &uploadRing);
+	glBindBuffer(GL_COPY_READ_BUFFER, uploadRing);
+	glBufferStorage(GL_COPY_READ_BUFFER, SEGMENT_SIZE * NUM_SEGMENTS, nullptr, flags);
+	uploadRingData = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, SEGMENT_SIZE * NUM_SEGMENTS, flags));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void GPUTransfer::upload(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	if (uploadRing == 0 && GLEW_ARB_buffer_storage)
+		createUploadRing();
+	if (uploadRingData == nullptr)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return;
+	}
+
+	// Large uploads go through the ring a segment at a time
+	const uint8_t* source = static_cast<const uint8_t*>(data);
+	glBindBuffer(GL_COPY_READ_BUFFER, uploadRing);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	while (size > 0)
+	{
+		GLsizeiptr chunkSize = std::min(size, SEGMENT_SIZE);
+		GLintptr segmentOffset = nextSegment * SEGMENT_SIZE;
+		waitFence(segmentFences[nextSegment]);
+		memcpy(uploadRingData + segmentOffset, source, chunkSize);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, segmentOffset, offset, chunkSize);
+		segmentFences[nextSegment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nextSegment = (nextSegment + 1) % NUM_SEGMENTS;
+
+		source += chunkSize;
+		offset += chunkSize;
+		size -= chunkSize;
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GPUTransfer::startReadback(GLuint buffer, GLsizeiptr size)
+{
+	if (readbackFence != 0)
+	{
+		glDeleteSync(readbackFence);
+		readbackFence = 0;
+	}
+
+	if (size > readbackCapacity)
+	{
+		// Immutable storage can't grow, so replace the staging buffer
+		if (readbackBuffer != 0)
+			glDeleteBuffers(1, &readbackBuffer);
+		glGenBuffers(1, &readbackBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+		if (GLEW_ARB_buffer_storage)
+		{
+			GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+			readbackData = static_cast<const uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+		}
+		else
+		{
+			glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_READ);
+		}
+		readbackCapacity = size;
+	}
+
+	// Shader writes to the source buffer must land before the copy reads it
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readbackSize = size;
+	// Make sure the copy is submitted, so the fence signals without anyone waiting on it
+	glFlush();
+}
+
+bool GPUTransfer::isReadbackPending()
+{
+	return readbackFence != 0;
+}
+
+bool GPUTransfer::finishReadback(void* data, bool wait)
+{
+	if (readbackFence == 0 || (!wait && glClientWaitSync(readbackFence, 0, 0) == GL_TIMEOUT_EXPIRED))
+		return false;
+	waitFence(readbackFence);
+
+	if (readbackData != nullptr)
+	{
+		memcpy(data, readbackData, readbackSize);
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, readbackSize, data);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	return true;
+}
@@ -0,0 +1,52 @@
+#ifndef GPU_TRANSFER_H
+#define GPU_TRANSFER_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/* Moves data between CPU memory and GPU buffers without stalling the pipeline.
+   Uploads are written into a persistently mapped ring buffer (GL_ARB_buffer_storage) and copied from there into the
+   destination buffer on the GPU. The ring is split into NUM_SEGMENTS segments with a fence each, and a segment is only
+   written again once the GPU has copied out of it, so the destination buffer is never reallocated or orphaned.
+   Readbacks copy the source buffer into a persistently mapped staging buffer on the GPU and fence the copy. The data
+   can be taken a frame or two later without waiting, where glGetBufferSubData waits for every queued command.
+   Without GL_ARB_buffer_storage uploads fall back to glBufferSubData, and the staging buffer is read with
+   glGetBufferSubData once its fence has signaled, which doesn't stall either.
+   Nothing touches OpenGL until the first transfer, so an unused GPUTransfer needs no context. */
+class GPUTransfer
+{
+public:
+	static const GLsizeiptr SEGMENT_SIZE = 4 << 20;
+	static const int NUM_SEGMENTS = 4;
+
+	GPUTransfer();
+	virtual ~GPUTransfer();
+
+	// Copy size bytes of data to the buffer at offset. Only waits if the GPU hasn't copied out of the ring segments yet.
+	void upload(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data);
+	// Start copying the first size bytes of the buffer to the staging buffer, replacing any readback still in flight
+	void startReadback(GLuint buffer, GLsizeiptr size);
+	bool isReadbackPending();
+	/* Copy the data of the last startReadback() to data (size bytes) once the GPU is done with it. Returns false, and
+	   leaves data alone, if there is no readback or it isn't finished yet and wait is false. */
+	bool finishReadback(void* data, bool wait = false);
+private:
+	// Create and map the ring buffer on the first upload
+	void createUploadRing();
+
+	GLuint uploadRing;
+	// Persistent mappings, nullptr without GL_ARB_buffer_storage
+	uint8_t* uploadRingData;
+	GLsync segmentFences[NUM_SEGMENTS];
+	int nextSegment;
+
+	GLuint readbackBuffer;
+	GLsizeiptr readbackCapacity;
+	GLsizeiptr readbackSize;
+	const uint8_t* readbackData;
+	GLsync readbackFence;
+};
+
+#endif // GPU_TRANSFER_H
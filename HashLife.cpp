@@ -0,0 +1,356 @@
+#include "HashLife.h"
+
+HashLife::HashLife()
+{
+	resultStepLog2 = 0;
+	epoch = 0;
+	clear();
+}
+
+HashLife::~HashLife()
+{
+}
+
+void HashLife::setRule(const CellRule& rule)
+{
+	transition = CellTransition(rule);
+	// Results computed with the old rule are wrong now, but the octree itself doesn't depend on the rule
+	clearResults();
+}
+
+void HashLife::setCells(const uint8_t* cells, int x, int y, int z, int width, int height, int depth)
+{
+	if (width <= 0 || height <= 0 || depth <= 0)
+		return;
+	expandRootToFit(std::min({ x, y, z }), std::max({ static_cast<int64_t>(x) + width, static_cast<int64_t>(y) + height, static_cast<int64_t>(z) + depth }));
+	int64_t rootOffset = -(static_cast<int64_t>(1) << (nodes[root].level - 1));
+	root = setBox(root, rootOffset, rootOffset, rootOffset, cells, x, y, z, width, height, depth);
+	shrinkRoot();
+}
+
+void HashLife::getCells(uint8_t* cells, int x, int y, int z, int width, int height, int depth)
+{
+	if (width <= 0 || height <= 0 || depth <= 0)
+		return;
+	std::fill(cells, cells + static_cast<size_t>(width) * height * depth, 0);
+	int64_t rootOffset = -(static_cast<int64_t>(1) << (nodes[root].level - 1));
+	getBox(root, rootOffset, rootOffset, rootOffset, cells, x, y, z, width, height, depth);
+}
+
+void HashLife::clear()
+{
+	// Drop every node except the leaves
+	nodes.clear();
+	nodeTable.clear();
+	for (int i = 0; i < MAX_STATES; i++)
+	{
+		Node leaf;
+		for (int j = 0; j < 8; j++)
+			leaf.children[j] = NO_NODE;
+		leaf.level = 0;
+		leaf.result = NO_NODE;
+		nodes.push_back(leaf);
+	}
+	emptyNodes.clear();
+	emptyNodes.push_back(0);
+	root = getEmptyNode(MIN_LEVEL);
+	generation = 0;
+	epoch++;
+}
+
+void HashLife::simulate(uint64_t generations)
+{
+	for (int i = 0; i < 64; i++)
+		if (generations & (static_cast<uint64_t>(1) << i))
+			step(i);
+}
+
+uint64_t HashLife::getGeneration()
+{
+	return generation;
+}
+
+int HashLife::getNumNodes()
+{
+	return static_cast<int>(nodes.size());
+}
+
+uint64_t HashLife::getStateHash()
+{
+	int level = nodes[root].level;
+	if (root == getEmptyNode(level))
+		return 0;
+	return epoch << 40 | static_cast<uint64_t>(level) << 32 | root;
+}
+
+size_t HashLife::NodeHash::operator()(const std::array<NodeID, 8>& children) const
+{
+	uint64_t hash = 0;
+	for (int i = 0; i < 8; i++)
+		hash = (hash ^ children[i]) * 0x9E3779B97F4A7C15ull;
+	return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+HashLife::NodeID HashLife::join(const NodeID children[8])
+{
+	std::array<NodeID, 8> key;
+	for (int i = 0; i < 8; i++)
+		key[i] = children[i];
+	auto it = nodeTable.find(key);
+	if (it != nodeTable.end())
+		return it->second;
+
+	Node node;
+	for (int i = 0; i < 8; i++)
+		node.children[i] = children[i];
+	node.level = nodes[children[0]].level + 1;
+	node.result = NO_NODE;
+	NodeID id = static_cast<NodeID>(nodes.size());
+	nodes.push_back(node);
+	nodeTable.emplace(key, id);
+	return id;
+}
+
+HashLife::NodeID HashLife::getEmptyNode(int level)
+{
+	while (static_cast<int>(emptyNodes.size()) <= level)
+	{
+		NodeID children[8];
+		for (int i = 0; i < 8; i++)
+			children[i] = emptyNodes.back();
+		emptyNodes.push_back(join(children));
+	}
+	return emptyNodes[level];
+}
+
+HashLife::NodeID HashLife::getCenter(NodeID node)
+{
+	// Each child contributes the grandchild in the octant closest to the center
+	NodeID children[8];
+	for (int i = 0; i < 8; i++)
+		children[i] = nodes[nodes[node].children[i]].children[7 - i];
+	return join(children);
+}
+
+HashLife::NodeID HashLife::expand(NodeID node)
+{
+	int level = nodes[node].level;
+	NodeID empty = getEmptyNode(level - 1);
+	NodeID children[8];
+	for (int i = 0; i < 8; i++)
+	{
+		NodeID grandchildren[8];
+		for (int j = 0; j < 8; j++)
+			grandchildren[j] = empty;
+		grandchildren[7 - i] = nodes[node].children[i];
+		children[i] = join(grandchildren);
+	}
+	return join(children);
+}
+
+bool HashLife::isCentered(NodeID node)
+{
+	NodeID empty = getEmptyNode(nodes[node].level - 2);
+	for (int i = 0; i < 8; i++)
+	{
+		const Node& child = nodes[nodes[node].children[i]];
+		for (int j = 0; j < 8; j++)
+			if (j != 7 - i && child.children[j] != empty)
+				return false;
+	}
+	return true;
+}
+
+/* For a node of level k, this returns its center half (level k - 1) advanced by 2^j generations, where
+   j = min(resultStepLog2, k - 2). Since cells only see their direct neighbors, 2^(k - 2) generations is as far as the
+   center can be advanced without knowing anything outside the node.
+
+   The node is split into a 4x4x4 grid of grandchildren, from which 27 overlapping nodes of level k - 1 are built. For a
+   full step (j = k - 2), each of them is advanced by 2^(k - 3) generations, the 27 results are regrouped into 8
+   overlapping nodes of level k - 1, and those are advanced by another 2^(k - 3) generations. For a smaller step, the 27
+   nodes are only cropped to their centers and all of the advancing is done by the second round. */
+HashLife::NodeID HashLife::advance(NodeID node)
+{
+	if (nodes[node].result != NO_NODE)
+		return nodes[node].result;
+
+	int level = nodes[node].level;
+	if (level == 2)
+	{
+		NodeID result = advanceLeaves(node);
+		nodes[node].result = result;
+		return result;
+	}
+
+	NodeID grid[4][4][4];
+	for (int i = 0; i < 8; i++)
+	{
+		const Node& child = nodes[nodes[node].children[i]];
+		for (int j = 0; j < 8; j++)
+			grid[(i >> 2) * 2 + (j >> 2)][((i >> 1) & 1) * 2 + ((j >> 1) & 1)][(i & 1) * 2 + (j & 1)] = child.children[j];
+	}
+
+	bool fullStep = resultStepLog2 >= level - 2;
+	NodeID partial[3][3][3];
+	for (int z = 0; z < 3; z++)
+	{
+		for (int y = 0; y < 3; y++)
+		{
+			for (int x = 0; x < 3; x++)
+			{
+				NodeID children[8];
+				for (int i = 0; i < 8; i++)
+					children[i] = grid[z + (i >> 2)][y + ((i >> 1) & 1)][x + (i & 1)];
+				NodeID subnode = join(children);
+				partial[z][y][x] = fullStep ? advance(subnode) : getCenter(subnode);
+			}
+		}
+	}
+
+	NodeID resultChildren[8];
+	for (int i = 0; i < 8; i++)
+	{
+		NodeID children[8];
+		for (int j = 0; j < 8; j++)
+			children[j] = partial[(i >> 2) + (j >> 2)][((i >> 1) & 1) + ((j >> 1) & 1)][(i & 1) + (j & 1)];
+		resultChildren[i] = advance(join(children));
+	}
+
+	NodeID result = join(resultChildren);
+	nodes[node].result = result;
+	return result;
+}
+
+HashLife::NodeID HashLife::advanceLeaves(NodeID node)
+{
+	uint8_t cells[4][4][4];
+	for (int i = 0; i < 8; i++)
+	{
+		const Node& child = nodes[nodes[node].children[i]];
+		for (int j = 0; j < 8; j++)
+			cells[(i >> 2) * 2 + (j >> 2)][((i >> 1) & 1) * 2 + ((j >> 1) & 1)][(i & 1) * 2 + (j & 1)] = static_cast<uint8_t>(child.children[j]);
+	}
+
+	NodeID resultChildren[8];
+	for (int i = 0; i < 8; i++)
+	{
+		int x = 1 + (i & 1);
+		int y = 1 + ((i >> 1) & 1);
+		int z = 1 + (i >> 2);
+		int n = 0;
+		for (int dz = -1; dz <= 1; dz++)
+			for (int dy = -1; dy <= 1; dy++)
+				for (int dx = -1; dx <= 1; dx++)
+					n += int(cells[z + dz][y + dy][x + dx] == 1);
+		const uint8_t state = cells[z][y][x];
+		n -= int(state == 1);
+		resultChildren[i] = transition.apply(state, n);
+	}
+	return join(resultChildren);
+}
+
+void HashLife::clearResults()
+{
+	for (Node& node : nodes)
+		node.result = NO_NODE;
+}
+
+void HashLife::collectGarbage()
+{
+	std::vector<Node> oldNodes;
+	oldNodes.swap(nodes);
+	NodeID oldRoot = root;
+	uint64_t oldGeneration = generation;
+	clear();
+	generation = oldGeneration;
+
+	std::vector<NodeID> remap(oldNodes.size(), NO_NODE);
+	for (int i = 0; i < MAX_STATES; i++)
+		remap[i] = i;
+	root = copyNode(oldRoot, oldNodes, remap);
+}
+
+HashLife::NodeID HashLife::copyNode(NodeID node, const std::vector<Node>& oldNodes, std::vector<NodeID>& remap)
+{
+	if (remap[node] != NO_NODE)
+		return remap[node];
+	NodeID children[8];
+	for (int i = 0; i < 8; i++)
+		children[i] = copyNode(oldNodes[node].children[i], oldNodes, remap);
+	remap[node] = join(children);
+	return remap[node];
+}
+
+void HashLife::expandRootToFit(int64_t low, int64_t high)
+{
+	while (true)
+	{
+		int64_t halfSize = static_cast<int64_t>(1) << (nodes[root].level - 1);
+		if (low >= -halfSize && high <= halfSize)
+			return;
+		root = expand(root);
+	}
+}
+
+void HashLife::shrinkRoot()
+{
+	while (nodes[root].level > MIN_LEVEL && isCentered(root))
+		root = getCenter(root);
+}
+
+HashLife::NodeID HashLife::setBox(NodeID node, int64_t nodeX, int64_t nodeY, int64_t nodeZ, const uint8_t* cells, int x, int y, int z, int width, int height, int depth)
+{
+	int level = nodes[node].level;
+	int64_t size = static_cast<int64_t>(1) << level;
+	if (nodeX >= x + width || nodeX + size <= x || nodeY >= y + height || nodeY + size <= y || nodeZ >= z + depth || nodeZ + size <= z)
+		return node;
+	if (level == 0)
+		return cells[(nodeX - x) + (nodeY - y) * width + (nodeZ - z) * width * height];
+
+	int64_t halfSize = size / 2;
+	NodeID children[8];
+	for (int i = 0; i < 8; i++)
+		children[i] = setBox(nodes[node].children[i], nodeX + (i & 1) * halfSize, nodeY + ((i >> 1) & 1) * halfSize, nodeZ + (i >> 2) * halfSize, cells, x, y, z, width, height, depth);
+	return join(children);
+}
+
+void HashLife::getBox(NodeID node, int64_t nodeX, int64_t nodeY, int64_t nodeZ, uint8_t* cells, int x, int y, int z, int width, int height, int depth)
+{
+	int level = nodes[node].level;
+	int64_t size = static_cast<int64_t>(1) << level;
+	if (nodeX >= x + width || nodeX + size <= x || nodeY >= y + height || nodeY + size <= y || nodeZ >= z + depth || nodeZ + size <= z)
+		return;
+	// The output starts out zeroed, so empty nodes can be skipped
+	if (node == getEmptyNode(level))
+		return;
+	if (level == 0)
+	{
+		cells[(nodeX - x) + (nodeY - y) * width + (nodeZ - z) * width * height] = static_cast<uint8_t>(node);
+		return;
+	}
+
+	int64_t halfSize = size / 2;
+	for (int i = 0; i < 8; i++)
+		getBox(nodes[node].children[i], nodeX + (i & 1) * halfSize, nodeY + ((i >> 1) & 1) * halfSize, nodeZ + (i >> 2) * halfSize, cells, x, y, z, width, height, depth);
+}
+
+void HashLife::step(int stepLog2)
+{
+	if (resultStepLog2 != stepLog2)
+	{
+		clearResults();
+		resultStepLog2 = stepLog2;
+	}
+
+	/* The pattern grows by at most 1 cell per generation, so before jumping 2^stepLog2 generations all non-zero cells
+	   must be in the center quarter of the root and the root must be at least of level stepLog2 + 3. Then the result of
+	   the root (its center half) is big enough to hold everything. */
+	while (nodes[root].level < stepLog2 + 2 || !isCentered(root))
+		root = expand(root);
+	root = advance(expand(root));
+	generation += static_cast<uint64_t>(1) << stepLog2;
+	shrinkRoot();
+
+	if (nodes.size() > MAX_NODES)
+		collectGarbage();
+}
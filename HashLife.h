@@ -0,0 +1,111 @@
+#ifndef HASH_LIFE_H
+#define HASH_LIFE_H
+
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+
+#include "CellRule.h"
+
+/* HashLife engine for the cell rules in CellRulesShader. The world is an infinite grid stored as an octree where every
+   node is canonicalized (two nodes with the same contents are the same node), and the result of advancing each node is
+   memoized. Repeated structure in space and time is therefore only simulated once, which lets simulate() jump ahead
+   by huge numbers of generations for patterns that are periodic or stable.
+
+   Leaves are single cells holding the full state (0 to NUM_STATES - 1), so the refractory countdown of multi-state
+   rules is handled exactly like in the compute shader. As in UnboundedWorld, space outside the octree is assumed to be
+   empty, so rules containing B 0 don't fill the infinite grid. */
+class HashLife
+{
+public:
+	HashLife();
+	virtual ~HashLife();
+
+	// Only the radius 1 Moore neighborhood is supported, so neighbor counts above 26 are ignored
+	void setRule(const CellRule& rule);
+
+	// Copy a box of width x height x depth cells with its lowest corner at (x, y, z) into the world
+	void setCells(const uint8_t* cells, int x, int y, int z, int width, int height, int depth);
+	// Copy a box of width x height x depth cells with its lowest corner at (x, y, z) out of the world
+	void getCells(uint8_t* cells, int x, int y, int z, int width, int height, int depth);
+	// Remove every cell
+	void clear();
+	/* Advance the world by any number of generations. This is done in one jump of 2^k generations for each bit set in
+	   generations, and each jump takes time roughly proportional to the number of distinct nodes, not to 2^k. */
+	void simulate(uint64_t generations = 1);
+
+	uint64_t getGeneration();
+	int getNumNodes();
+	/* Hash of the whole world: the canonical root node and its level, which is exact and O(1) because the root is always
+	   the smallest centered node holding every cell. An empty world hashes to 0 like in hashCells(). Node IDs are reused
+	   after a garbage collection, so a state from before one never matches the same state after it. */
+	uint64_t getStateHash();
+private:
+	typedef uint32_t NodeID;
+	static const NodeID NO_NODE = 0xFFFFFFFF;
+	// Node IDs 0 to MAX_STATES - 1 are the leaves, a leaf's ID is its cell state
+	static const int MAX_STATES = 256;
+	// The root never shrinks below this level, so the smallest world is 2^MIN_LEVEL cells wide
+	static const int MIN_LEVEL = 3;
+	// When there are more nodes than this after a jump, every node not reachable from the root is freed
+	static const size_t MAX_NODES = 1 << 22;
+
+	/* A node at level k is a cube of 2^k cells on each side. Children are indexed by octant: child x + y * 2 + z * 4
+	   covers the half of the cube at (x, y, z). */
+	struct Node
+	{
+		NodeID children[8];
+		int level;
+		// The center half of this node advanced by 2^min(stepLog2, level - 2) generations, NO_NODE if not computed yet
+		NodeID result;
+	};
+	struct NodeHash
+	{
+		size_t operator()(const std::array<NodeID, 8>& children) const;
+	};
+
+	// Return the canonical node with these children, creating it if it doesn't exist yet
+	NodeID join(const NodeID children[8]);
+	// Canonical node of the given level where every cell is 0
+	NodeID getEmptyNode(int level);
+	// The node of level k - 1 at the center of a node of level k
+	NodeID getCenter(NodeID node);
+	// A node of level k + 1 with this node at its center and empty space around it
+	NodeID expand(NodeID node);
+	// Whether all non-zero cells of the node lie in its center half
+	bool isCentered(NodeID node);
+	// Memoized core of HashLife, see HashLife.cpp
+	NodeID advance(NodeID node);
+	// Advance the 4x4x4 cells of a level 2 node by one generation and return the center 2x2x2 cells as a level 1 node
+	NodeID advanceLeaves(NodeID node);
+	// Forget every memoized result, needed when the rule or the jump size changes
+	void clearResults();
+	// Rebuild the node table from the nodes reachable from the root
+	void collectGarbage();
+	NodeID copyNode(NodeID node, const std::vector<Node>& oldNodes, std::vector<NodeID>& remap);
+	// Replace the root by bigger nodes until the box [low, high) fits inside it
+	void expandRootToFit(int64_t low, int64_t high);
+	// Replace the root by its center while nothing is lost
+	void shrinkRoot();
+	NodeID setBox(NodeID node, int64_t nodeX, int64_t nodeY, int64_t nodeZ, const uint8_t* cells, int x, int y, int z, int width, int height, int depth);
+	void getBox(NodeID node, int64_t nodeX, int64_t nodeY, int64_t nodeZ, uint8_t* cells, int x, int y, int z, int width, int height, int depth);
+	// Jump 2^stepLog2 generations
+	void step(int stepLog2);
+
+	std::vector<Node> nodes;
+	std::unordered_map<std::array<NodeID, 8>, NodeID, NodeHash> nodeTable;
+	// emptyNodes[k] is the empty node of level k, filled in on demand
+	std::vector<NodeID> emptyNodes;
+	// The root node is centered on the origin, so a root of level k covers cells -2^(k-1) to 2^(k-1) - 1 on each axis
+	NodeID root;
+	// Jump size the memoized results were computed for
+	int resultStepLog2;
+	// Number of times the node table was rebuilt by clear(), to tell apart node IDs from before and after
+	uint64_t epoch;
+	uint64_t generation;
+	CellTransition transition;
+};
+
+#endif // HASH_LIFE_H
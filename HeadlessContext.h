@@ -0,0 +1,14 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <iostream>
+
+/* Create an OpenGL 4.3 core context with EGL and make it current, without any window or surface. Works with
+   surfaceless Mesa, so the GPU engine can run on compute nodes without a display. Rendering needs a framebuffer object
+   since there is no default framebuffer. Returns false and prints the reason if no context could be created. */
+bool createHeadlessContext();
+
+#endif // HEADLESS_CONTEXT_H
@@ -0,0 +1,159 @@
+#include "StateHistory.h"
+
+uint64_t hashCellWord(uint32_t index, uint32_t word)
+{
+	// Each round is a bijection of (x0, x1), so different inputs never give the same hash
+	uint32_t x0 = word;
+	uint32_t x1 = index;
+	uint32_t key = 0x85ebca6bu;
+	for (int round = 0; round < 10; round++)
+	{
+		uint64_t product = static_cast<uint64_t>(0xd256d193u) * x0;
+		x0 = static_cast<uint32_t>(product >> 32) ^ key ^ x1;
+		x1 = static_cast<uint32_t>(product);
+		key += 0x9e3779b9u;
+	}
+	return static_cast<uint64_t>(x1) << 32 | x0;
+}
+
+uint64_t hashCells(const uint8_t* cells, int size, ThreadPool* threadPool)
+{
+	const int numWords = size / 4;
+	// Chunks of words, so each thread XORs its own partial hash
+	const int CHUNK_WORDS = 1 << 14;
+	const int numChunks = (numWords + CHUNK_WORDS - 1) / CHUNK_WORDS;
+	std::vector<uint64_t> chunkHashes(numChunks, 0);
+	auto hashChunks = [&](int begin, int end)
+	{
+		for (int chunk = begin; chunk < end; chunk++)
+		{
+			uint64_t hash = 0;
+			for (int i = chunk * CHUNK_WORDS; i < std::min((chunk + 1) * CHUNK_WORDS, numWords); i++)
+			{
+				const uint8_t* bytes = cells + 4 * i;
+				uint32_t word = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+				if (word != 0)
+					hash ^= hashCellWord(static_cast<uint32_t>(i), word);
+			}
+			chunkHashes[chunk] = hash;
+		}
+	};
+
+	if (threadPool != nullptr)
+		threadPool->parallelFor(numChunks, hashChunks);
+	else
+		hashChunks(0, numChunks);
+
+	uint64_t hash = 0;
+	for (uint64_t chunkHash : chunkHashes)
+		hash ^= chunkHash;
+	// The cells after the last whole word, padded with 0 cells
+	if (size % 4 != 0)
+	{
+		uint32_t word = 0;
+		for (int i = 0; i < size % 4; i++)
+			word |= static_cast<uint32_t>(cells[4 * numWords + i]) << (8 * i);
+		if (word != 0)
+			hash ^= hashCellWord(static_cast<uint32_t>(numWords), word);
+	}
+	return hash;
+}
+
+// The splitmix64 finalizer
+static uint64_t mixBits(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+uint64_t hashBlock(uint64_t key, uint64_t contentHash)
+{
+	if (contentHash == 0)
+		return 0;
+	return mixBits(contentHash ^ mixBits(key + 0x9e3779b97f4a7c15ull));
+}
+
+StateHistory::StateHistory(int capacity)
+{
+	this->capacity = std::max(capacity, 1);
+	clear();
+}
+
+void StateHistory::clear()
+{
+	hashes.clear();
+	generationsByHash.clear();
+	steadyState = SteadyState{ Kind::None, 0, 0, 0 };
+}
+
+void StateHistory::add(uint64_t generation, uint64_t hash)
+{
+	if (!hashes.empty() && generation != hashes.back().first + 1)
+		clear();
+
+	if (steadyState.kind == Kind::None)
+	{
+		auto previous = generationsByHash.find(hash);
+		if (previous != generationsByHash.end())
+		{
+			/* This is the first repeated hash, so the generation before the previous one (if it is in the table) wasn't
+			   repeated by the generation before this one, and the steady state starts at the previous one. An empty grid
+			   only counts as dead once it stays empty, since rules with B 0 bring it back to life. */
+			uint64_t period = generation - previous->second;
+			Kind kind = period > 1 ? Kind::Cycle : (hash == 0 ? Kind::Dead : Kind::Static);
+			steadyState = SteadyState{ kind, period, previous->second, generation };
+		}
+	}
+
+	hashes.push_back(std::make_pair(generation, hash));
+	generationsByHash[hash] = generation;
+	if (static_cast<int>(hashes.size()) > capacity)
+	{
+		// A hash seen again later points at its newer generation, which stays in the table
+		auto oldest = generationsByHash.find(hashes.front().second);
+		if (oldest->second == hashes.front().first)
+			generationsByHash.erase(oldest);
+		hashes.pop_front();
+	}
+}
+
+StateHistory::SteadyState StateHistory::getSteadyState()
+{
+	return steadyState;
+}
+
+bool StateHistory::hasHashes()
+{
+	return !hashes.empty();
+}
+
+uint64_t StateHistory::getLastGeneration()
+{
+	return hashes.back().first;
+}
+
+uint64_t StateHistory::getLastHash()
+{
+	return hashes.back().second;
+}
+
+int StateHistory::getCapacity()
+{
+	return capacity;
+}
+
+const char* StateHistory::getKindName(Kind kind)
+{
+	switch (kind)
+	{
+	case Kind::Dead:
+		return "dead";
+	case Kind::Static:
+		return "static";
+	case Kind::Cycle:
+		return "cycle";
+	default:
+		return "none";
+	}
+}
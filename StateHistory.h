@@ -0,0 +1,82 @@
+#ifndef STATE_HISTORY_H
+#define STATE_HISTORY_H
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+/* 64-bit hash of one packed word of 4 cells (the first cell in the lowest byte) at word index index: 10 rounds of
+   Philox-2x32 on (word, index), which maps different (index, word) pairs to different hashes. The rules shaders of
+   CellRulesShader have a GLSL copy, which must give the same hashes. */
+uint64_t hashCellWord(uint32_t index, uint32_t word);
+/* Hash of a whole grid of size bytes: the XOR of hashCellWord() over its non-zero words. The order the words are added
+   in doesn't matter, so the GPU can reduce the hashes of a generation in parallel, and empty words and bricks which are
+   skipped add nothing. A grid of only 0 cells hashes to 0. If size isn't a multiple of 4 the last word is padded with 0
+   cells, so an unpadded grid hashes the same as the padded GPU buffer. The words are split into chunks of 16384 that
+   are hashed by the threads of the pool, or on the calling thread without one. */
+uint64_t hashCells(const uint8_t* cells, int size, ThreadPool* threadPool = nullptr);
+
+/* Hash of a block of cells with content hash contentHash (from hashCells()) at the position key, for grids which are
+   stored in separately allocated blocks. The XOR of it over all blocks hashes the whole grid, and an empty block
+   (contentHash 0) adds nothing, so it doesn't matter which empty blocks happen to be allocated. */
+uint64_t hashBlock(uint64_t key, uint64_t contentHash);
+
+/* Remembers the state hashes of the last generations and tells when the automaton settles down: Dead when every cell
+   stays 0, Static when a generation is the same as the one before, or Cycle when a generation repeats the one period
+   generations earlier. Each is found one period after it starts. From the start generation on the automaton repeats
+   itself forever, so a runner can stop there or jump ahead to any later generation by simulating only
+   (target - start) % period more generations.
+   Only periods of at most the capacity of the table are found. The hashes are compared, not the cells, so two
+   different states may be taken for the same one with a chance of about 2^-64. */
+class StateHistory
+{
+public:
+	enum class Kind
+	{
+		None,
+		Dead,
+		Static,
+		Cycle
+	};
+
+	struct SteadyState
+	{
+		Kind kind;
+		// 1 for Dead and Static
+		uint64_t period;
+		// First generation of the steady state, so generation start + period is the same as start
+		uint64_t start;
+		// Generation whose hash revealed the steady state
+		uint64_t detected;
+	};
+
+	StateHistory(int capacity = 4096);
+
+	// Forget every hash, for when the cells change in any other way than simulating one generation
+	void clear();
+	/* Add the hash of a generation. Generations must be added one after another, a gap clears the table first. Once
+	   a steady state is found it is kept until clear(), since the generations after it can't tell anything new. */
+	void add(uint64_t generation, uint64_t hash);
+	SteadyState getSteadyState();
+	bool hasHashes();
+	// The last generation added and its hash, only valid if hasHashes()
+	uint64_t getLastGeneration();
+	uint64_t getLastHash();
+	int getCapacity();
+
+	static const char* getKindName(Kind kind);
+private:
+	int capacity;
+	// Generation and hash of the last capacity generations, oldest first
+	std::deque<std::pair<uint64_t, uint64_t>> hashes;
+	// The last generation with each hash in the table
+	std::unordered_map<uint64_t, uint64_t> generationsByHash;
+	SteadyState steadyState;
+};
+
+#endif // STATE_HISTORY_H
@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int numThreads)
+{
+	if (numThreads <= 0)
+		numThreads = static_cast<int>(std::thread::hardware_concurrency());
+	if (numThreads <= 0)
+		numThreads = 1;
+	this->numThreads = numThreads;
+	task = nullptr;
+	taskCount = 0;
+	jobID = 0;
+	pendingWorkers = 0;
+	quit = false;
+
+	// Thread 0 is the caller of parallelFor, so only numThreads - 1 workers are spawned
+	for (int i = 1; i < numThreads; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	workReady.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int)>& task)
+{
+	if (count <= 0)
+		return;
+	if (workers.empty() || count == 1)
+	{
+		task(0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->task = &task;
+		taskCount = count;
+		pendingWorkers = static_cast<int>(workers.size());
+		jobID++;
+	}
+	workReady.notify_all();
+
+	runChunk(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	workDone.wait(lock, [this] { return pendingWorkers == 0; });
+	this->task = nullptr;
+}
+
+int ThreadPool::getNumThreads()
+{
+	return numThreads;
+}
+
+void ThreadPool::workerLoop(int threadIndex)
+{
+	int lastJobID = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workReady.wait(lock, [this, lastJobID] { return quit || jobID != lastJobID; });
+			if (quit)
+				return;
+			lastJobID = jobID;
+		}
+
+		runChunk(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingWorkers--;
+		}
+		workDone.notify_one();
+	}
+}
+
+void ThreadPool::runChunk(int threadIndex)
+{
+	// Chunk boundaries are spread evenly, so chunk sizes differ by at most 1
+	int begin = static_cast<int>(static_cast<long long>(taskCount) * threadIndex / numThreads);
+	int end = static_cast<int>(static_cast<long long>(taskCount) * (threadIndex + 1) / numThreads);
+	if (begin < end)
+		(*task)(begin, end);
+}
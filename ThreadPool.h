@@ -0,0 +1,39 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// numThreads = 0 uses one thread per hardware core. The calling thread always takes part in the work.
+	ThreadPool(int numThreads = 0);
+	virtual ~ThreadPool();
+
+	/* Split the range [0, count) into contiguous chunks, one per thread, and call task(begin, end) for each chunk.
+	   Blocks until every chunk has finished. Chunks never overlap, so tasks can write to disjoint output without locking. */
+	void parallelFor(int count, const std::function<void(int, int)>& task);
+	int getNumThreads();
+private:
+	void workerLoop(int threadIndex);
+	void runChunk(int threadIndex);
+
+	int numThreads;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable workReady;
+	std::condition_variable workDone;
+	// Current job, only valid while a parallelFor call is in progress
+	const std::function<void(int, int)>* task;
+	int taskCount;
+	// Incremented for each job so workers can tell a new job from a spurious wakeup
+	int jobID;
+	int pendingWorkers;
+	bool quit;
+};
+
+#endif // THREAD_POOL_H
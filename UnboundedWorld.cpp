@@ -0,0 +1,327 @@
+#include "UnboundedWorld.h"
+
+UnboundedWorld::UnboundedWorld(ThreadPool& threadPool)
+	: threadPool(threadPool)
+{
+	current = 0;
+}
+
+UnboundedWorld::~UnboundedWorld()
+{
+}
+
+void UnboundedWorld::setRule(const CellRule& rule)
+{
+	transition = CellTransition(rule);
+}
+
+void UnboundedWorld::setCells(const uint8_t* cells, int x, int y, int z, int width, int height, int depth)
+{
+	for (int cz = getChunkCoordinate(z); cz <= getChunkCoordinate(z + depth - 1); cz++)
+	{
+		for (int cy = getChunkCoordinate(y); cy <= getChunkCoordinate(y + height - 1); cy++)
+		{
+			for (int cx = getChunkCoordinate(x); cx <= getChunkCoordinate(x + width - 1); cx++)
+			{
+				// Intersection of the box and this chunk, in world coordinates
+				int x0 = std::max(x, cx * CHUNK_SIZE), x1 = std::min(x + width, (cx + 1) * CHUNK_SIZE);
+				int y0 = std::max(y, cy * CHUNK_SIZE), y1 = std::min(y + height, (cy + 1) * CHUNK_SIZE);
+				int z0 = std::max(z, cz * CHUNK_SIZE), z1 = std::min(z + depth, (cz + 1) * CHUNK_SIZE);
+
+				Chunk* chunk = getChunk(cx, cy, cz);
+				if (chunk == nullptr)
+				{
+					// Don't allocate chunks just to fill them with zeros
+					bool nonZero = false;
+					for (int wz = z0; wz < z1 && !nonZero; wz++)
+						for (int wy = y0; wy < y1 && !nonZero; wy++)
+							for (int wx = x0; wx < x1 && !nonZero; wx++)
+								nonZero = cells[(wx - x) + (wy - y) * width + (wz - z) * width * height] != 0;
+					if (!nonZero)
+						continue;
+					chunk = createChunk(cx, cy, cz);
+				}
+
+				for (int wz = z0; wz < z1; wz++)
+				{
+					for (int wy = y0; wy < y1; wy++)
+					{
+						const uint8_t* source = cells + (x0 - x) + (wy - y) * width + (wz - z) * width * height;
+						uint8_t* destination = chunk->cells[current] + (x0 - cx * CHUNK_SIZE) + (wy - cy * CHUNK_SIZE) * CHUNK_SIZE + (wz - cz * CHUNK_SIZE) * CHUNK_SIZE * CHUNK_SIZE;
+						std::copy(source, source + (x1 - x0), destination);
+					}
+				}
+				analyzeChunk(chunk);
+			}
+		}
+	}
+}
+
+void UnboundedWorld::getCells(uint8_t* cells, int x, int y, int z, int width, int height, int depth)
+{
+	for (int cz = getChunkCoordinate(z); cz <= getChunkCoordinate(z + depth - 1); cz++)
+	{
+		for (int cy = getChunkCoordinate(y); cy <= getChunkCoordinate(y + height - 1); cy++)
+		{
+			for (int cx = getChunkCoordinate(x); cx <= getChunkCoordinate(x + width - 1); cx++)
+			{
+				int x0 = std::max(x, cx * CHUNK_SIZE), x1 = std::min(x + width, (cx + 1) * CHUNK_SIZE);
+				int y0 = std::max(y, cy * CHUNK_SIZE), y1 = std::min(y + height, (cy + 1) * CHUNK_SIZE);
+				int z0 = std::max(z, cz * CHUNK_SIZE), z1 = std::min(z + depth, (cz + 1) * CHUNK_SIZE);
+
+				Chunk* chunk = getChunk(cx, cy, cz);
+				for (int wz = z0; wz < z1; wz++)
+				{
+					for (int wy = y0; wy < y1; wy++)
+					{
+						uint8_t* destination = cells + (x0 - x) + (wy - y) * width + (wz - z) * width * height;
+						// Space without a chunk is empty
+						if (chunk == nullptr)
+						{
+							std::fill(destination, destination + (x1 - x0), 0);
+							continue;
+						}
+						const uint8_t* source = chunk->cells[current] + (x0 - cx * CHUNK_SIZE) + (wy - cy * CHUNK_SIZE) * CHUNK_SIZE + (wz - cz * CHUNK_SIZE) * CHUNK_SIZE * CHUNK_SIZE;
+						std::copy(source, source + (x1 - x0), destination);
+					}
+				}
+			}
+		}
+	}
+}
+
+void UnboundedWorld::clear()
+{
+	chunks.clear();
+	chunkList.clear();
+}
+
+void UnboundedWorld::simulate()
+{
+	updateChunks();
+
+	// Chunks only read the current state of their neighbors, so they can be simulated in any order
+	threadPool.parallelFor(static_cast<int>(chunkList.size()), [this](int begin, int end)
+	{
+		std::vector<uint8_t> neighborhood((CHUNK_SIZE + 2) * (CHUNK_SIZE + 2) * (CHUNK_SIZE + 2));
+		for (int i = begin; i < end; i++)
+			simulateChunk(chunkList[i], neighborhood.data());
+	});
+
+	current = 1 - current;
+	threadPool.parallelFor(static_cast<int>(chunkList.size()), [this](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+			analyzeChunk(chunkList[i]);
+	});
+}
+
+uint64_t UnboundedWorld::hashState()
+{
+	// chunkList may miss chunks that setCells() created since the last timestep
+	std::vector<std::pair<uint64_t, const Chunk*>> allChunks;
+	allChunks.reserve(chunks.size());
+	for (const auto& entry : chunks)
+		allChunks.emplace_back(entry.first, entry.second.get());
+
+	std::vector<uint64_t> chunkHashes(allChunks.size());
+	threadPool.parallelFor(static_cast<int>(allChunks.size()), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const Chunk* chunk = allChunks[i].second;
+			uint64_t contentHash = hashCells(chunk->cells[current], CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE);
+			chunkHashes[i] = hashBlock(allChunks[i].first, contentHash);
+		}
+	});
+
+	uint64_t hash = 0;
+	for (uint64_t chunkHash : chunkHashes)
+		hash ^= chunkHash;
+	return hash;
+}
+
+int UnboundedWorld::getNumChunks()
+{
+	return static_cast<int>(chunks.size());
+}
+
+uint64_t UnboundedWorld::getChunkKey(int x, int y, int z)
+{
+	// 21 bits per coordinate, which allows +-2^20 chunks in each direction
+	const uint64_t mask = (static_cast<uint64_t>(1) << 21) - 1;
+	return (static_cast<uint64_t>(x) & mask) | ((static_cast<uint64_t>(y) & mask) << 21) | ((static_cast<uint64_t>(z) & mask) << 42);
+}
+
+int UnboundedWorld::getChunkCoordinate(int c)
+{
+	return c >= 0 ? c / CHUNK_SIZE : -((-c + CHUNK_SIZE - 1) / CHUNK_SIZE);
+}
+
+UnboundedWorld::Chunk* UnboundedWorld::getChunk(int x, int y, int z)
+{
+	auto it = chunks.find(getChunkKey(x, y, z));
+	return it == chunks.end() ? nullptr : it->second.get();
+}
+
+UnboundedWorld::Chunk* UnboundedWorld::createChunk(int x, int y, int z)
+{
+	std::unique_ptr<Chunk> chunk(new Chunk());
+	chunk->x = x;
+	chunk->y = y;
+	chunk->z = z;
+	std::fill(chunk->cells[0], chunk->cells[0] + CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE, 0);
+	std::fill(chunk->cells[1], chunk->cells[1] + CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE, 0);
+	std::fill(chunk->neighbors, chunk->neighbors + 27, nullptr);
+	chunk->nonZero = false;
+	chunk->liveBorders = 0;
+
+	Chunk* result = chunk.get();
+	chunks[getChunkKey(x, y, z)] = std::move(chunk);
+	return result;
+}
+
+void UnboundedWorld::updateChunks()
+{
+	// A chunk is needed if it has non-zero cells, or if a neighboring chunk has a live cell right next to it
+	std::unordered_set<uint64_t> neededChunks;
+	// Coordinates of needed chunks which don't exist yet (the map can't be modified while iterating over it)
+	std::vector<int> newChunkCoordinates;
+	for (auto& entry : chunks)
+	{
+		Chunk* chunk = entry.second.get();
+		if (chunk->nonZero)
+			neededChunks.insert(entry.first);
+		for (int i = 0; i < 27; i++)
+		{
+			if (((chunk->liveBorders >> i) & 1) == 0)
+				continue;
+			int x = chunk->x + i % 3 - 1, y = chunk->y + (i / 3) % 3 - 1, z = chunk->z + i / 9 - 1;
+			neededChunks.insert(getChunkKey(x, y, z));
+			if (chunks.count(getChunkKey(x, y, z)) == 0)
+			{
+				newChunkCoordinates.push_back(x);
+				newChunkCoordinates.push_back(y);
+				newChunkCoordinates.push_back(z);
+			}
+		}
+	}
+
+	// Free chunks which are empty and can't have any cells born in them next step
+	for (auto it = chunks.begin(); it != chunks.end();)
+	{
+		if (neededChunks.count(it->first) == 0)
+			it = chunks.erase(it);
+		else
+			it++;
+	}
+
+	for (size_t i = 0; i < newChunkCoordinates.size(); i += 3)
+	{
+		if (getChunk(newChunkCoordinates[i], newChunkCoordinates[i + 1], newChunkCoordinates[i + 2]) == nullptr)
+			createChunk(newChunkCoordinates[i], newChunkCoordinates[i + 1], newChunkCoordinates[i + 2]);
+	}
+
+	// Link every chunk to its neighbors for simulateChunk
+	chunkList.clear();
+	for (auto& entry : chunks)
+	{
+		Chunk* chunk = entry.second.get();
+		for (int i = 0; i < 27; i++)
+			chunk->neighbors[i] = getChunk(chunk->x + i % 3 - 1, chunk->y + (i / 3) % 3 - 1, chunk->z + i / 9 - 1);
+		chunkList.push_back(chunk);
+	}
+}
+
+void UnboundedWorld::analyzeChunk(Chunk* chunk)
+{
+	const uint8_t* cells = chunk->cells[current];
+	chunk->nonZero = false;
+	chunk->liveBorders = 0;
+	for (int z = 0; z < CHUNK_SIZE; z++)
+	{
+		for (int y = 0; y < CHUNK_SIZE; y++)
+		{
+			const uint8_t* row = cells + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE;
+			bool borderRow = z == 0 || z == CHUNK_SIZE - 1 || y == 0 || y == CHUNK_SIZE - 1;
+			for (int x = 0; x < CHUNK_SIZE; x++)
+			{
+				if (row[x] == 0)
+					continue;
+				chunk->nonZero = true;
+				if (row[x] != 1 || (!borderRow && x != 0 && x != CHUNK_SIZE - 1))
+					continue;
+
+				// This live cell is on the border, so mark every neighbor chunk it touches
+				int xMin = x == 0 ? -1 : 0, xMax = x == CHUNK_SIZE - 1 ? 1 : 0;
+				int yMin = y == 0 ? -1 : 0, yMax = y == CHUNK_SIZE - 1 ? 1 : 0;
+				int zMin = z == 0 ? -1 : 0, zMax = z == CHUNK_SIZE - 1 ? 1 : 0;
+				for (int dz = zMin; dz <= zMax; dz++)
+					for (int dy = yMin; dy <= yMax; dy++)
+						for (int dx = xMin; dx <= xMax; dx++)
+							chunk->liveBorders |= static_cast<uint32_t>(1) << ((dx + 1) + (dy + 1) * 3 + (dz + 1) * 9);
+			}
+		}
+	}
+	// The chunk itself is not a neighbor
+	chunk->liveBorders &= ~(static_cast<uint32_t>(1) << 13);
+}
+
+void UnboundedWorld::simulateChunk(Chunk* chunk, uint8_t* neighborhood)
+{
+	const int paddedSize = CHUNK_SIZE + 2;
+
+	// Gather the chunk plus a 1 cell border from the neighboring chunks. Missing chunks are empty.
+	for (int pz = 0; pz < paddedSize; pz++)
+	{
+		int cz = pz - 1;
+		int chunkZ = cz < 0 ? 0 : cz < CHUNK_SIZE ? 1 : 2;
+		int localZ = cz - (chunkZ - 1) * CHUNK_SIZE;
+		for (int py = 0; py < paddedSize; py++)
+		{
+			int cy = py - 1;
+			int chunkY = cy < 0 ? 0 : cy < CHUNK_SIZE ? 1 : 2;
+			int localY = cy - (chunkY - 1) * CHUNK_SIZE;
+			uint8_t* row = neighborhood + py * paddedSize + pz * paddedSize * paddedSize;
+			for (int chunkX = 0; chunkX < 3; chunkX++)
+			{
+				// Left neighbor provides 1 cell (its last), the chunk itself CHUNK_SIZE cells, the right neighbor 1 cell (its first)
+				int start = chunkX == 0 ? 0 : chunkX == 1 ? 1 : CHUNK_SIZE + 1;
+				int count = chunkX == 1 ? CHUNK_SIZE : 1;
+				int localX = chunkX == 0 ? CHUNK_SIZE - 1 : 0;
+				Chunk* neighbor = chunk->neighbors[chunkX + chunkY * 3 + chunkZ * 9];
+				if (neighbor == nullptr)
+				{
+					std::fill(row + start, row + start + count, 0);
+					continue;
+				}
+				const uint8_t* source = neighbor->cells[current] + localX + localY * CHUNK_SIZE + localZ * CHUNK_SIZE * CHUNK_SIZE;
+				std::copy(source, source + count, row + start);
+			}
+		}
+	}
+
+	uint8_t* futureState = chunk->cells[1 - current];
+	for (int z = 0; z < CHUNK_SIZE; z++)
+	{
+		for (int y = 0; y < CHUNK_SIZE; y++)
+		{
+			// The 9 rows of the 3x3x3 neighborhood that pass through this row of cells, offset by 1 for the border
+			const uint8_t* rows[9];
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					rows[i * 3 + j] = neighborhood + (y + j) * paddedSize + (z + i) * paddedSize * paddedSize;
+
+			uint8_t* futureRow = futureState + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE;
+			for (int x = 0; x < CHUNK_SIZE; x++)
+			{
+				int n = 0;
+				for (int i = 0; i < 9; i++)
+					n += int(rows[i][x] == 1) + int(rows[i][x + 1] == 1) + int(rows[i][x + 2] == 1);
+				const uint8_t state = rows[4][x + 1];
+				n -= int(state == 1);
+				futureRow[x] = transition.apply(state, n);
+			}
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef UNBOUNDED_WORLD_H
+#define UNBOUNDED_WORLD_H
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+#include "ThreadPool.h"
+#include "CellRule.h"
+#include "StateHistory.h"
+
+/* An infinite grid of cells, stored as a hash map of CHUNK_SIZE^3 chunks. Only chunks which contain non-zero cells, or
+   which have a live cell right next to their border, are allocated, so memory stays proportional to the live structure
+   and growth patterns never wrap around into themselves. The rules are the same as in CellRulesShader, except that
+   cells can't be born in empty space far away from any live cell, so rules containing B 0 only take effect inside
+   allocated chunks. */
+class UnboundedWorld
+{
+public:
+	static const int CHUNK_SIZE = 16;
+
+	// Chunks are simulated on the threads of threadPool, which must outlive the world
+	UnboundedWorld(ThreadPool& threadPool);
+	virtual ~UnboundedWorld();
+
+	// Only the radius 1 Moore neighborhood is supported, so neighbor counts above 26 are ignored
+	void setRule(const CellRule& rule);
+
+	// Copy a box of width x height x depth cells with its lowest corner at (x, y, z) into the world
+	void setCells(const uint8_t* cells, int x, int y, int z, int width, int height, int depth);
+	// Copy a box of width x height x depth cells with its lowest corner at (x, y, z) out of the world
+	void getCells(uint8_t* cells, int x, int y, int z, int width, int height, int depth);
+	// Remove every cell
+	void clear();
+	// Simulate one timestep
+	void simulate();
+	/* Hash of every cell of the world, not just of a box of it: the XOR of hashBlock() over all chunks, keyed by their
+	   chunk coordinates. Since empty chunks add nothing, the same cells give the same hash wherever chunks are
+	   allocated. */
+	uint64_t hashState();
+
+	int getNumChunks();
+private:
+	struct Chunk
+	{
+		int x, y, z;
+		// Current and future state, UnboundedWorld::current is the index of the current state
+		uint8_t cells[2][CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE];
+		// The 3x3x3 block of chunks around this one (including itself in the middle), nullptr where there is no chunk
+		Chunk* neighbors[27];
+		bool nonZero;
+		// Bit (x + 1) + (y + 1) * 3 + (z + 1) * 9 is set if the neighbor chunk at offset (x, y, z) borders a live cell of this chunk
+		uint32_t liveBorders;
+	};
+
+	static uint64_t getChunkKey(int x, int y, int z);
+	// Round down to the chunk which contains cell coordinate c
+	static int getChunkCoordinate(int c);
+	Chunk* getChunk(int x, int y, int z);
+	Chunk* createChunk(int x, int y, int z);
+	// Allocate chunks next to live borders, free chunks that are empty and not needed, and link chunk neighbors
+	void updateChunks();
+	// Update nonZero and liveBorders of a chunk from its current state
+	void analyzeChunk(Chunk* chunk);
+	// neighborhood is a (CHUNK_SIZE + 2)^3 scratch buffer
+	void simulateChunk(Chunk* chunk, uint8_t* neighborhood);
+
+	std::unordered_map<uint64_t, std::unique_ptr<Chunk>> chunks;
+	// Chunks in the order they are simulated, rebuilt by updateChunks()
+	std::vector<Chunk*> chunkList;
+	// Index of the current state in Chunk::cells
+	int current;
+	CellTransition transition;
+	ThreadPool& threadPool;
+};
+
+#endif // UNBOUNDED_WORLD_H
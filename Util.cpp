@@ -1,5 +1,41 @@
 #include "Util.h"
 
+#include <fstream>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+static std::string programCacheDirectory = "shader_cache";
+
+// Cache file of a source, named after the FNV-1a hash of the driver strings and the source
+static std::string getProgramCachePath(const std::string& source)
+{
+	std::string key;
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		const GLubyte* str = glGetString(name);
+		key += str != nullptr ? reinterpret_cast<const char*>(str) : "";
+		key += '\n';
+	}
+	key += source;
+
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : key)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.bin", static_cast<unsigned long long>(hash));
+	return programCacheDirectory + "/" + fileName;
+}
+
 void printShaderCompileErrors(GLuint shader)
 {
 	GLint success;
@@ -22,6 +58,160 @@ void printShaderCompileErrors(GLuint shader)
 	}
 }
 
+GLuint createComputeProgram(const std::string& source, const std::string& name)
+{
+	GLuint program = startComputeProgram(source);
+	finishComputeProgram(program, name);
+	return program;
+}
+
+GLuint startComputeProgram(const std::string& source)
+{
+	GLuint cachedProgram = loadCachedProgram(source);
+	if (cachedProgram != 0)
+		return cachedProgram;
+
+	const char* shaderSourceStr = source.c_str();
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &shaderSourceStr, nullptr);
+	glCompileShader(shader);
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	if (isProgramCacheEnabled())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+
+	// The shader stays alive while it is attached, so finishComputeProgram can still read its log
+	glDeleteShader(shader);
+
+	return program;
+}
+
+bool isComputeProgramReady(GLuint program)
+{
+	// Without the extension there is no way to ask, and finishing blocks just like before
+	if (!GLEW_KHR_parallel_shader_compile)
+		return true;
+
+	GLint ready = GL_FALSE;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &ready);
+	return ready == GL_TRUE;
+}
+
+void finishComputeProgram(GLuint program, const std::string& name)
+{
+	// Programs loaded from the cache have no shader attached
+	GLsizei shaderCount = 0;
+	GLuint shader = 0;
+	glGetAttachedShaders(program, 1, &shaderCount, &shader);
+	if (shaderCount == 0)
+	{
+		std::cout << name << " loaded from the program cache." << std::endl << std::endl;
+		return;
+	}
+
+	std::cout << name << " compilation:" << std::endl;
+	printShaderCompileErrors(shader);
+	std::cout << std::endl;
+
+	if (isProgramCacheEnabled())
+	{
+		GLint sourceLength = 0;
+		glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &sourceLength);
+		std::string source(sourceLength, ' ');
+		glGetShaderSource(shader, sourceLength, &sourceLength, &source[0]);
+		source.resize(sourceLength);
+		saveCachedProgram(program, source);
+	}
+}
+
+void setProgramCacheDirectory(const std::string& directory)
+{
+	programCacheDirectory = directory;
+}
+
+bool isProgramCacheEnabled()
+{
+	if (programCacheDirectory.empty() || !GLEW_ARB_get_program_binary)
+		return false;
+
+	// Drivers may support the extension without offering any binary format
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	return numFormats > 0;
+}
+
+GLuint loadCachedProgram(const std::string& source)
+{
+	if (!isProgramCacheEnabled())
+		return 0;
+
+	std::ifstream file(getProgramCachePath(source), std::ios::binary);
+	GLenum format = 0;
+	if (!file.read(reinterpret_cast<char*>(&format), sizeof(format)))
+		return 0;
+	std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	std::vector<GLint> formats(numFormats);
+	glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+	if (binary.empty() || std::find(formats.begin(), formats.end(), static_cast<GLint>(format)) == formats.end())
+		return 0;
+
+	// A binary from another driver build or a truncated file fails the link, and the caller compiles the source
+	// instead. Saving that program replaces the stale binary.
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+	GLint success = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (success == GL_FALSE)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void saveCachedProgram(GLuint program, const std::string& source)
+{
+	GLint success = GL_FALSE;
+	GLint length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (!isProgramCacheEnabled() || success == GL_FALSE || length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	// The directory usually exists already, and a failure to create it shows up as a failure to open the file
+#ifdef _WIN32
+	_mkdir(programCacheDirectory.c_str());
+#else
+	mkdir(programCacheDirectory.c_str(), 0755);
+#endif
+	std::ofstream file(getProgramCachePath(source), std::ios::binary | std::ios::trunc);
+	if (!file)
+		return;
+	file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	file.write(binary.data(), length);
+}
+
+void waitFence(GLsync& fence)
+{
+	if (fence == 0)
+		return;
+	// Flush on the first wait so the fence is sure to signal, then wait in steps of a second
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (glClientWaitSync(fence, flags, 1000000000) == GL_TIMEOUT_EXPIRED)
+		flags = 0;
+	glDeleteSync(fence);
+	fence = 0;
+}
+
 void stringReplace(std::string& input, const std::string& find, const std::string& replace)
 {
 	size_t pos = input.find(find);
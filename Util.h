@@ -7,6 +7,28 @@
 
 void printShaderCompileErrors(GLuint shader);
 
+// Compile and link a compute shader, printing compile errors to the console under the given name
+GLuint createComputeProgram(const std::string& source, const std::string& name);
+/* createComputeProgram in two halves. startComputeProgram only submits the shader, and with
+   GL_KHR_parallel_shader_compile the driver compiles and links it on its own threads while isComputeProgramReady()
+   returns false. finishComputeProgram waits for it if needed and prints the compile errors. */
+GLuint startComputeProgram(const std::string& source);
+bool isComputeProgramReady(GLuint program);
+void finishComputeProgram(GLuint program, const std::string& name);
+
+/* Linked programs are cached on disk as glGetProgramBinary output, keyed by a hash of their source and the driver's
+   vendor, renderer and version strings, so the next run with the same rule and grid size skips the compile and link.
+   The cache needs GL_ARB_get_program_binary and is off when the directory is empty (default: "shader_cache"). */
+void setProgramCacheDirectory(const std::string& directory);
+// Load the program with this source from the cache. Returns 0 on a miss or if the driver rejects the stored binary.
+GLuint loadCachedProgram(const std::string& source);
+// Store a linked program in the cache under its source. Link it with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+void saveCachedProgram(GLuint program, const std::string& source);
+bool isProgramCacheEnabled();
+
+// Wait for the fence and delete it, flushing so it is sure to signal. Does nothing for a 0 fence.
+void waitFence(GLsync& fence);
+
 void stringReplace(std::string& input, const std::string& find, const std::string& replace);
 
 #endif // UTIL_H
@@ -0,0 +1,488 @@
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtx/rotate_vector.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+
+#include "CellRulesShader.h"
+#include "CellMeshingShader.h"
+#include "CellRenderShader.h"
+#include "Automaton.h"
+#include "HeadlessContext.h"
+#include "Util.h"
+
+/* Benchmark suite: sweeps grid sizes, every preset automaton, seed densities and engines, and times the simulation,
+   meshing and rendering of each frame separately. GPU work is timed with GL_TIME_ELAPSED queries, simulate() on the
+   CPU engines with a high resolution clock (including the upload of the new state to the cell SSBO). Every
+   configuration is seeded with the same key (see CubeSeed), so results are comparable across commits and machines.
+
+   Usage: benchmark [--sizes 64,128,256,512] [--presets all|NAME,NAME] [--densities 0,2,10] [--engines gpu,cpu,...]
+                    [--frames N] [--warmup N] [--seed S] [--format csv|json] [--output FILE] [--no-render] [--six-pass]
+                    [--greedy | --vertex-pulling] [--face-masks] [--tile-size T] [--rule-table] [--no-program-cache]
+
+   Density 0 uses the preset's own seed, any other density n fills the whole grid with probability 1/n.
+   --six-pass meshes and draws each side of the cubes separately instead of all sides in one pass, --greedy and
+   --vertex-pulling select the meshing mode of CellMeshingShader. --face-masks meshes from the face masks written by the
+   GPU rules shader (the previous generation) instead of the current cells. --tile-size sets the shared memory tile size
+   of the GPU rules shader (see CellRulesShader::setTileSize), --rule-table makes it look up the next states in a table
+   (see CellRulesShader::setUseRuleTable). --no-program-cache compiles every shader instead of loading the binaries
+   cached by earlier runs (see setProgramCacheDirectory). */
+
+struct BenchmarkResult
+{
+    std::string engine;
+    std::string preset;
+    int size;
+    int density;
+    int frames;
+    // Average time per frame in milliseconds, and the fastest frame
+    double simulateMs, simulateMinMs;
+    double meshMs, meshMinMs;
+    double renderMs, renderMinMs;
+    double stepsPerSecond;
+    double cellsPerSecond;
+    // "ok", or why the configuration was skipped or only partially measured
+    std::string status;
+};
+
+static std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static std::string engineName(CellRulesShader::Engine engine)
+{
+    switch (engine)
+    {
+    case CellRulesShader::Engine::GPU:
+        return "gpu";
+    case CellRulesShader::Engine::CPU:
+        return "cpu";
+    case CellRulesShader::Engine::CPUBitplane:
+        return "cpu-bitplane";
+    case CellRulesShader::Engine::CPUUnbounded:
+        return "cpu-unbounded";
+    case CellRulesShader::Engine::CPUHashLife:
+        return "cpu-hashlife";
+    }
+    return "unknown";
+}
+
+static bool parseEngine(const std::string& name, CellRulesShader::Engine& engine)
+{
+    const CellRulesShader::Engine engines[] =
+    {
+        CellRulesShader::Engine::GPU, CellRulesShader::Engine::CPU, CellRulesShader::Engine::CPUBitplane,
+        CellRulesShader::Engine::CPUUnbounded, CellRulesShader::Engine::CPUHashLife
+    };
+    for (CellRulesShader::Engine candidate : engines)
+    {
+        if (engineName(candidate) == name)
+        {
+            engine = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string escapeJSON(const std::string& input)
+{
+    std::string output;
+    for (char c : input)
+    {
+        if (c == '"' || c == '\\')
+            output += '\\';
+        output += c;
+    }
+    return output;
+}
+
+// Milliseconds of GPU time measured by a finished GL_TIME_ELAPSED query
+static double queryMilliseconds(GLuint query)
+{
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    return nanoseconds / 1.0e6;
+}
+
+static BenchmarkResult runBenchmark(CellRulesShader::Engine engine, const Automaton& preset, int size, int density,
+    int frames, int warmupFrames, unsigned int seed, bool render, bool sixPass,
+    CellMeshingShader::Mode meshingMode, bool faceMasks, int tileSize, bool useRuleTable)
+{
+    BenchmarkResult result;
+    result.engine = engineName(engine);
+    result.preset = preset.name;
+    result.size = size;
+    result.density = density;
+    result.frames = 0;
+    result.simulateMs = result.simulateMinMs = 0.0;
+    result.meshMs = result.meshMinMs = 0.0;
+    result.renderMs = result.renderMinMs = 0.0;
+    result.stepsPerSecond = 0.0;
+    result.cellsPerSecond = 0.0;
+    result.status = "ok";
+
+    // Clear old errors so GL_OUT_OF_MEMORY can be blamed on this configuration
+    bool usesGL = render || engine == CellRulesShader::Engine::GPU;
+    if (usesGL)
+    {
+        while (glGetError() != GL_NO_ERROR)
+            ;
+    }
+
+    CellRulesShader* cellRulesShader = nullptr;
+    CellMeshingShader* cellMeshingShader = nullptr;
+    CellRenderShader* cellRenderShader = nullptr;
+    try
+    {
+        cellRulesShader = new CellRulesShader(size, size, size, preset.rule, engine, faceMasks);
+        if (engine == CellRulesShader::Engine::GPU)
+        {
+            cellRulesShader->setTileSize(tileSize);
+            cellRulesShader->setUseRuleTable(useRuleTable);
+        }
+        if (render)
+        {
+            cellMeshingShader = new CellMeshingShader(size, size, size, meshingMode);
+            cellRenderShader = new CellRenderShader(size, size, size, *cellMeshingShader);
+        }
+    }
+    catch (const std::invalid_argument& e)
+    {
+        delete cellRulesShader;
+        result.status = e.what();
+        return result;
+    }
+    if (usesGL && glGetError() == GL_OUT_OF_MEMORY)
+    {
+        result.status = "out of GPU memory";
+        delete cellRenderShader;
+        delete cellMeshingShader;
+        delete cellRulesShader;
+        return result;
+    }
+
+    cellRulesShader->seedCells(density == 0 ? preset.seed : CubeSeed{ density, size }, seed);
+
+    // Same camera as the interactive viewer with the mouse in the corner
+    glm::mat4 view =
+        glm::translate(glm::vec3(0.0f, 0.0f, -1.3f * size)) *
+        glm::translate(glm::vec3(-size / 2.0f, -size / 2.0f, -size / 2.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(70.0f), 1.0f, 0.1f, 1000.0f);
+    glm::mat4 mvp = projection * view;
+
+    // One query for the simulation, and one per meshing and rendering stage since timer queries can't overlap
+    GLuint queries[13] = {};
+    if (usesGL)
+        glGenQueries(13, queries);
+
+    double totalSimulate = 0.0, totalMesh = 0.0, totalRender = 0.0;
+    double minSimulate = 1.0e30, minMesh = 1.0e30, minRender = 1.0e30;
+    for (int frame = 0; frame < warmupFrames + frames; frame++)
+    {
+        double simulateMs = 0.0;
+        if (engine == CellRulesShader::Engine::GPU)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+            cellRulesShader->simulate();
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+        else
+        {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            cellRulesShader->simulate();
+            if (render)
+            {
+                cellRulesShader->getCellSSBO();
+                cellRulesShader->getBrickFlagSSBO();
+            }
+            auto endTime = std::chrono::high_resolution_clock::now();
+            simulateMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+        }
+
+        int numPasses = sixPass ? 6 : 1;
+        if (render)
+        {
+            for (int i = 0; i < numPasses; i++)
+            {
+                int stage = sixPass ? i : CellMeshingShader::ALL_STAGES;
+                glBeginQuery(GL_TIME_ELAPSED, queries[1 + i]);
+                if (cellRulesShader->getFaceMaskCellSSBO() != 0)
+                    cellMeshingShader->meshCells(cellRulesShader->getFaceMaskCellSSBO(), cellRulesShader->getFaceCountSSBO(), stage, preset.colorScheme, cellRulesShader->getFaceMaskSSBO());
+                else
+                    cellMeshingShader->meshCells(cellRulesShader->getCellSSBO(), cellRulesShader->getBrickFlagSSBO(), stage, preset.colorScheme);
+                glEndQuery(GL_TIME_ELAPSED);
+                glBeginQuery(GL_TIME_ELAPSED, queries[7 + i]);
+                cellRenderShader->renderMesh(mvp);
+                glEndQuery(GL_TIME_ELAPSED);
+            }
+        }
+
+        // Reading the query results waits for the frame to finish, so frames don't pile up in the command queue
+        if (engine == CellRulesShader::Engine::GPU)
+            simulateMs = queryMilliseconds(queries[0]);
+        double meshMs = 0.0, renderMs = 0.0;
+        if (render)
+        {
+            for (int i = 0; i < numPasses; i++)
+            {
+                meshMs += queryMilliseconds(queries[1 + i]);
+                renderMs += queryMilliseconds(queries[7 + i]);
+            }
+        }
+
+        if (frame < warmupFrames)
+            continue;
+        totalSimulate += simulateMs;
+        totalMesh += meshMs;
+        totalRender += renderMs;
+        minSimulate = std::min(minSimulate, simulateMs);
+        minMesh = std::min(minMesh, meshMs);
+        minRender = std::min(minRender, renderMs);
+    }
+
+    if (usesGL)
+        glDeleteQueries(13, queries);
+    delete cellRenderShader;
+    delete cellMeshingShader;
+    delete cellRulesShader;
+
+    if (frames > 0)
+    {
+        result.frames = frames;
+        result.simulateMs = totalSimulate / frames;
+        result.meshMs = totalMesh / frames;
+        result.renderMs = totalRender / frames;
+        result.simulateMinMs = minSimulate;
+        result.meshMinMs = minMesh;
+        result.renderMinMs = minRender;
+        if (result.simulateMs > 0.0)
+            result.stepsPerSecond = 1000.0 / result.simulateMs;
+        result.cellsPerSecond = result.stepsPerSecond * size * size * size;
+    }
+    return result;
+}
+
+static void writeCSV(std::ostream& output, const std::vector<BenchmarkResult>& results)
+{
+    output << "engine,preset,size,density,frames,simulate_ms,simulate_min_ms,mesh_ms,mesh_min_ms,render_ms,render_min_ms,steps_per_sec,cells_per_sec,status" << std::endl;
+    for (const BenchmarkResult& result : results)
+    {
+        output << result.engine << ",\"" << result.preset << "\"," << result.size << "," << result.density << ","
+            << result.frames << "," << result.simulateMs << "," << result.simulateMinMs << "," << result.meshMs << ","
+            << result.meshMinMs << "," << result.renderMs << "," << result.renderMinMs << "," << result.stepsPerSecond
+            << "," << result.cellsPerSecond << ",\"" << result.status << "\"" << std::endl;
+    }
+}
+
+static void writeJSON(std::ostream& output, const std::vector<BenchmarkResult>& results, const std::string& renderer, unsigned int seed)
+{
+    output << "{" << std::endl;
+    output << "  \"renderer\": \"" << escapeJSON(renderer) << "\"," << std::endl;
+    output << "  \"seed\": " << seed << "," << std::endl;
+    output << "  \"results\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult& result = results[i];
+        output << "    { \"engine\": \"" << result.engine << "\", \"preset\": \"" << escapeJSON(result.preset)
+            << "\", \"size\": " << result.size << ", \"density\": " << result.density << ", \"frames\": " << result.frames
+            << ", \"simulate_ms\": " << result.simulateMs << ", \"simulate_min_ms\": " << result.simulateMinMs
+            << ", \"mesh_ms\": " << result.meshMs << ", \"mesh_min_ms\": " << result.meshMinMs
+            << ", \"render_ms\": " << result.renderMs << ", \"render_min_ms\": " << result.renderMinMs
+            << ", \"steps_per_sec\": " << result.stepsPerSecond << ", \"cells_per_sec\": " << result.cellsPerSecond
+            << ", \"status\": \"" << escapeJSON(result.status) << "\" }" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    output << "  ]" << std::endl;
+    output << "}" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> sizes = { 64, 128, 256, 512 };
+    std::vector<int> densities = { 0, 2, 10 };
+    std::vector<std::string> presetNames;
+    std::vector<CellRulesShader::Engine> engines = { CellRulesShader::Engine::GPU };
+    int frames = 20;
+    int warmupFrames = 2;
+    unsigned int seed = 12345;
+    std::string format = "csv";
+    std::string outputPath;
+    bool render = true;
+    bool sixPass = false;
+    CellMeshingShader::Mode meshingMode = CellMeshingShader::Mode::Faces;
+    bool faceMasks = false;
+    int tileSize = 0;
+    bool useRuleTable = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue)
+        {
+            sizes.clear();
+            for (const std::string& item : splitList(argv[++i]))
+                sizes.push_back(std::atoi(item.c_str()));
+        }
+        else if (arg == "--densities" && hasValue)
+        {
+            densities.clear();
+            for (const std::string& item : splitList(argv[++i]))
+                densities.push_back(std::atoi(item.c_str()));
+        }
+        else if (arg == "--presets" && hasValue)
+        {
+            std::string list = argv[++i];
+            presetNames.clear();
+            if (list != "all")
+                presetNames = splitList(list);
+        }
+        else if (arg == "--engines" && hasValue)
+        {
+            engines.clear();
+            for (const std::string& item : splitList(argv[++i]))
+            {
+                CellRulesShader::Engine engine;
+                if (!parseEngine(item, engine))
+                {
+                    std::cerr << "Unknown engine: " << item << std::endl;
+                    return 1;
+                }
+                engines.push_back(engine);
+            }
+        }
+        else if (arg == "--frames" && hasValue)
+            frames = std::atoi(argv[++i]);
+        else if (arg == "--warmup" && hasValue)
+            warmupFrames = std::atoi(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            seed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--format" && hasValue)
+            format = argv[++i];
+        else if (arg == "--output" && hasValue)
+            outputPath = argv[++i];
+        else if (arg == "--no-render")
+            render = false;
+        else if (arg == "--six-pass")
+            sixPass = true;
+        else if (arg == "--greedy")
+            meshingMode = CellMeshingShader::Mode::Greedy;
+        else if (arg == "--vertex-pulling")
+            meshingMode = CellMeshingShader::Mode::VertexPulling;
+        else if (arg == "--face-masks")
+            faceMasks = true;
+        else if (arg == "--tile-size" && hasValue)
+            tileSize = std::atoi(argv[++i]);
+        else if (arg == "--rule-table")
+            useRuleTable = true;
+        else if (arg == "--no-program-cache")
+            setProgramCacheDirectory("");
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            std::cerr << "Usage: benchmark [--sizes 64,128,256,512] [--presets all|NAME,NAME] [--densities 0,2,10]" << std::endl;
+            std::cerr << "                 [--engines gpu,cpu,cpu-bitplane,cpu-unbounded,cpu-hashlife] [--frames N] [--warmup N]" << std::endl;
+            std::cerr << "                 [--seed S] [--format csv|json] [--output FILE] [--no-render] [--six-pass]" << std::endl;
+            std::cerr << "                 [--greedy | --vertex-pulling] [--face-masks] [--tile-size T] [--rule-table]" << std::endl;
+            std::cerr << "                 [--no-program-cache]" << std::endl;
+            return 1;
+        }
+    }
+    if (format != "csv" && format != "json")
+    {
+        std::cerr << "Unknown format: " << format << std::endl;
+        return 1;
+    }
+    // Shader compile logs go to stdout, so results go to a file unless told otherwise
+    if (outputPath.empty())
+        outputPath = "benchmark." + format;
+
+    bool usesGL = render || std::find(engines.begin(), engines.end(), CellRulesShader::Engine::GPU) != engines.end();
+    std::string renderer = "none";
+    GLuint framebuffer = 0, colorRenderbuffer = 0, depthRenderbuffer = 0;
+    if (usesGL)
+    {
+        if (!createHeadlessContext())
+            return 1;
+        renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+
+        // There is no default framebuffer without a surface, so render into one the size of the viewer window
+        const int FRAMEBUFFER_SIZE = 900;
+        glGenRenderbuffers(1, &colorRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+        glGenRenderbuffers(1, &depthRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+        glViewport(0, 0, FRAMEBUFFER_SIZE, FRAMEBUFFER_SIZE);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+    }
+
+    std::vector<BenchmarkResult> results;
+    for (int size : sizes)
+    {
+        // Seeds of some presets depend on the grid width
+        std::vector<Automaton> automata = getPresetAutomata(size);
+        for (const Automaton& preset : automata)
+        {
+            if (!presetNames.empty() && std::find(presetNames.begin(), presetNames.end(), preset.name) == presetNames.end())
+                continue;
+            for (int density : densities)
+            {
+                for (CellRulesShader::Engine engine : engines)
+                {
+                    std::cerr << engineName(engine) << " " << preset.name << " " << size << "^3 density " << density << std::endl;
+                    if (render)
+                        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    results.push_back(runBenchmark(engine, preset, size, density, frames, warmupFrames, seed, render, sixPass,
+                        meshingMode, faceMasks, tileSize, useRuleTable));
+                }
+            }
+        }
+    }
+
+    if (usesGL)
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &colorRenderbuffer);
+        glDeleteRenderbuffers(1, &depthRenderbuffer);
+    }
+
+    std::ofstream output(outputPath);
+    if (!output)
+    {
+        std::cerr << "Could not open " << outputPath << std::endl;
+        return 1;
+    }
+    if (format == "csv")
+        writeCSV(output, results);
+    else
+        writeJSON(output, results, renderer, seed);
+    std::cerr << "Wrote " << results.size() << " results to " << outputPath << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "CellRulesShader.h"
+#include "Automaton.h"
+#include "StateHistory.h"
+#include "HeadlessContext.h"
+#include "Util.h"
+
+/* Headless batch runner: simulates an automaton for a number of generations without opening a window, then reports
+   steps/sec and cells/sec. The GPU engine runs in an offscreen EGL context (surfaceless Mesa works), CPU engines need
+   no OpenGL context at all.
+
+   Usage: headless [--preset NAME | --rule RULE] [--size N | --width W --height H --depth D] [--seed S]
+                   [--generations G] [--density N] [--cube W] [--jump] [--tile-size T] [--rule-table]
+                   [--no-program-cache] [--track-states | --stop-steady | --fast-forward]
+                   [--gpu | --cpu | --cpu-bitplane | --cpu-unbounded | --cpu-hashlife]
+   The setup time (creating the engine and compiling its shaders) is reported separately from the simulation.
+   --track-states hashes every generation (see CellRulesShader::setTrackStates) and reports whether the automaton died
+   out, stopped changing or cycled, and from which generation. --stop-steady stops simulating as soon as it does, and
+   --fast-forward then simulates only the generations needed to reach the state the last generation would have had. */
+
+static void printUsage()
+{
+    std::cerr << "Usage: headless [--preset NAME | --rule RULE] [--size N | --width W --height H --depth D] [--seed S]" << std::endl;
+    std::cerr << "                [--generations G] [--density N] [--cube W] [--jump] [--tile-size T] [--rule-table]" << std::endl;
+    std::cerr << "                [--no-program-cache] [--track-states | --stop-steady | --fast-forward]" << std::endl;
+    std::cerr << "                [--gpu | --cpu | --cpu-bitplane | --cpu-unbounded | --cpu-hashlife]" << std::endl;
+    std::cerr << "  --preset NAME   use the rule and seed of a built in automaton (default: first preset)" << std::endl;
+    std::cerr << "  --rule RULE     rule string, e.g. \"B 4,5 / S 10 / 15\", \"B 40-60 / S 30-70 / 5 / M3\" or \"B 1 / S 1,2 / 3 / N\"" << std::endl;
+    std::cerr << "  --density N     seed cells are alive with probability 1/N (overrides the preset seed)" << std::endl;
+    std::cerr << "  --cube W        seed a centered cube of width W (overrides the preset seed)" << std::endl;
+    std::cerr << "  --jump          advance all generations with one simulate(generations) call (HashLife)" << std::endl;
+    std::cerr << "  --tile-size T   GPU rules shader counts neighbors from shared memory tiles of T^3 cells (0, 4 or 8)" << std::endl;
+    std::cerr << "  --rule-table    GPU rules shader looks up the next state in a table instead of testing the counts" << std::endl;
+    std::cerr << "  --no-program-cache  always compile the shaders instead of loading them from the shader_cache directory" << std::endl;
+    std::cerr << "  --track-states  hash every generation and report when the automaton dies out, stops changing or cycles" << std::endl;
+    std::cerr << "  --stop-steady   --track-states, and stop simulating once the automaton is dead, static or cycling" << std::endl;
+    std::cerr << "  --fast-forward  --stop-steady, then skip ahead through the cycle to the state of the last generation" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    CellRulesShader::Engine engine = CellRulesShader::Engine::GPU;
+    std::string presetName;
+    std::string rule;
+    int width = 128;
+    int height = 128;
+    int depth = 128;
+    unsigned int seed = 1;
+    long long generations = 1000;
+    int density = 0;
+    int cubeWidth = 0;
+    bool jump = false;
+    int tileSize = 0;
+    bool useRuleTable = false;
+    bool trackStates = false;
+    bool stopSteady = false;
+    bool fastForward = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        // Options that take a value
+        bool hasValue = i + 1 < argc;
+        if (arg == "--gpu")
+            engine = CellRulesShader::Engine::GPU;
+        else if (arg == "--cpu")
+            engine = CellRulesShader::Engine::CPU;
+        else if (arg == "--cpu-bitplane")
+            engine = CellRulesShader::Engine::CPUBitplane;
+        else if (arg == "--cpu-unbounded")
+            engine = CellRulesShader::Engine::CPUUnbounded;
+        else if (arg == "--cpu-hashlife")
+            engine = CellRulesShader::Engine::CPUHashLife;
+        else if (arg == "--jump")
+            jump = true;
+        else if (arg == "--rule-table")
+            useRuleTable = true;
+        else if (arg == "--no-program-cache")
+            setProgramCacheDirectory("");
+        else if (arg == "--track-states")
+            trackStates = true;
+        else if (arg == "--stop-steady")
+            trackStates = stopSteady = true;
+        else if (arg == "--fast-forward")
+            trackStates = stopSteady = fastForward = true;
+        else if (arg == "--preset" && hasValue)
+            presetName = argv[++i];
+        else if (arg == "--rule" && hasValue)
+            rule = argv[++i];
+        else if (arg == "--size" && hasValue)
+            width = height = depth = std::atoi(argv[++i]);
+        else if (arg == "--width" && hasValue)
+            width = std::atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)
+            height = std::atoi(argv[++i]);
+        else if (arg == "--depth" && hasValue)
+            depth = std::atoi(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            seed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--generations" && hasValue)
+            generations = std::atoll(argv[++i]);
+        else if (arg == "--density" && hasValue)
+            density = std::atoi(argv[++i]);
+        else if (arg == "--cube" && hasValue)
+            cubeWidth = std::atoi(argv[++i]);
+        else if (arg == "--tile-size" && hasValue)
+            tileSize = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || depth <= 0 || generations < 0)
+    {
+        std::cerr << "Grid size must be positive and generations must not be negative" << std::endl;
+        return 1;
+    }
+
+    std::vector<Automaton> automata = getPresetAutomata(width);
+    Automaton automaton = automata[0];
+    if (!presetName.empty())
+    {
+        bool found = false;
+        for (const Automaton& preset : automata)
+        {
+            if (preset.name == presetName)
+            {
+                automaton = preset;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            std::cerr << "Unknown preset: " << presetName << std::endl << "Presets:";
+            for (const Automaton& preset : automata)
+                std::cerr << " \"" << preset.name << "\"";
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+    if (!rule.empty())
+    {
+        if (!CellRule::parse(rule).isValid())
+        {
+            std::cerr << "Invalid rule: " << rule << std::endl;
+            return 1;
+        }
+        automaton.name = "Custom";
+        automaton.rule = rule;
+    }
+    if (density > 0 || cubeWidth > 0)
+    {
+        if (density <= 0)
+            density = 2;
+        if (cubeWidth <= 0)
+            cubeWidth = width;
+        automaton.seed = CubeSeed{ density, cubeWidth };
+    }
+
+    if (engine == CellRulesShader::Engine::GPU && !createHeadlessContext())
+        return 1;
+
+    try
+    {
+        auto setupStartTime = std::chrono::high_resolution_clock::now();
+        CellRulesShader cellRulesShader(width, height, depth, automaton.rule, engine);
+        if (engine == CellRulesShader::Engine::GPU)
+        {
+            cellRulesShader.setTileSize(tileSize);
+            cellRulesShader.setUseRuleTable(useRuleTable);
+        }
+        cellRulesShader.setTrackStates(trackStates);
+        double setupSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - setupStartTime).count();
+        cellRulesShader.seedCells(automaton.seed, seed);
+        if (engine == CellRulesShader::Engine::GPU)
+            glFinish();
+        // Generations are reported from the seed on
+        uint64_t firstGeneration = cellRulesShader.getGeneration();
+        uint64_t lastGeneration = firstGeneration + static_cast<uint64_t>(generations);
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        StateHistory::SteadyState steadyState = cellRulesShader.getSteadyState();
+        if (jump)
+        {
+            cellRulesShader.simulate(static_cast<uint64_t>(generations));
+        }
+        else
+        {
+            // The GPU hashes arrive a few generations late, so the steady state is found a little after it is reached
+            while (cellRulesShader.getGeneration() < lastGeneration)
+            {
+                cellRulesShader.simulate();
+                if (stopSteady)
+                {
+                    steadyState = cellRulesShader.getSteadyState();
+                    if (steadyState.kind != StateHistory::Kind::None)
+                        break;
+                }
+            }
+        }
+        // From the start of a cycle on every generation repeats the one period generations earlier
+        long long skippedGenerations = static_cast<long long>(lastGeneration - cellRulesShader.getGeneration());
+        if (fastForward && steadyState.kind != StateHistory::Kind::None)
+            cellRulesShader.simulate(static_cast<uint64_t>(skippedGenerations) % steadyState.period);
+        long long simulatedGenerations = static_cast<long long>(cellRulesShader.getGeneration() - firstGeneration);
+        // Dispatches are asynchronous, so wait for the GPU to finish before stopping the clock
+        if (engine == CellRulesShader::Engine::GPU)
+            glFinish();
+        auto endTime = std::chrono::high_resolution_clock::now();
+        if (trackStates)
+            steadyState = cellRulesShader.finishStateHashes().getSteadyState();
+
+        double seconds = std::chrono::duration<double>(endTime - startTime).count();
+        double stepsPerSecond = seconds > 0.0 ? simulatedGenerations / seconds : 0.0;
+        double cellsPerSecond = stepsPerSecond * width * height * depth;
+        std::cout << "automaton: " << automaton.name << std::endl;
+        std::cout << "rule: " << automaton.rule << std::endl;
+        std::cout << "grid: " << width << "x" << height << "x" << depth << std::endl;
+        std::cout << "seed: " << seed << std::endl;
+        if (engine == CellRulesShader::Engine::GPU)
+        {
+            std::cout << "tile size: " << tileSize << std::endl;
+            std::cout << "rule table: " << (useRuleTable ? "yes" : "no") << std::endl;
+        }
+        std::cout << "setup seconds: " << setupSeconds << std::endl;
+        std::cout << "generations: " << generations << std::endl;
+        if (trackStates)
+        {
+            std::cout << "simulated generations: " << simulatedGenerations << std::endl;
+            std::cout << "steady state: " << StateHistory::getKindName(steadyState.kind);
+            if (steadyState.kind != StateHistory::Kind::None)
+            {
+                std::cout << ", period " << steadyState.period << " from generation " << steadyState.start - firstGeneration
+                          << ", found at generation " << steadyState.detected - firstGeneration;
+            }
+            std::cout << std::endl;
+        }
+        std::cout << "seconds: " << seconds << std::endl;
+        std::cout << "steps/sec: " << stepsPerSecond << std::endl;
+        std::cout << "cells/sec: " << cellsPerSecond << std::endl;
+    }
+    catch (const std::invalid_argument& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -6,19 +6,49 @@
 
 #include <iostream>
 #include <vector>
-#include <random>
+#include <ctime>
+#include <string>
 
 #include "CellRulesShader.h"
 #include "CellMeshingShader.h"
 #include "CellRenderShader.h"
 #include "Automaton.h"
+#include "FrameProfiler.h"
 
 int main(int argc, char* argv[]) 
 {
-    srand(time(nullptr));
     const int WIN_WIDTH = 900;
     const int WIN_HEIGHT = 900;
 
+    /* Simulation engine is chosen at startup: pass --cpu to run the automaton rules on the CPU instead of the GPU,
+       --cpu-bitplane to use the bit-packed CPU engine, or --cpu-unbounded to simulate an infinite grid on the CPU
+       (the rendered grid is then a window around the origin). --cpu-hashlife also simulates an infinite grid, but can
+       jump far ahead in time (press J). --greedy merges flat surfaces of the mesh into large faces, --vertex-pulling
+       renders from a list of visible faces instead of a vertex buffer, which needs much less memory. --face-masks lets
+       the GPU rules shader find the visible faces while simulating, so the mesher doesn't read the neighbor cells. */
+    CellRulesShader::Engine engine = CellRulesShader::Engine::GPU;
+    CellMeshingShader::Mode meshingMode = CellMeshingShader::Mode::Faces;
+    bool faceMasks = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--cpu")
+            engine = CellRulesShader::Engine::CPU;
+        else if (std::string(argv[i]) == "--cpu-bitplane")
+            engine = CellRulesShader::Engine::CPUBitplane;
+        else if (std::string(argv[i]) == "--cpu-unbounded")
+            engine = CellRulesShader::Engine::CPUUnbounded;
+        else if (std::string(argv[i]) == "--cpu-hashlife")
+            engine = CellRulesShader::Engine::CPUHashLife;
+        else if (std::string(argv[i]) == "--gpu")
+            engine = CellRulesShader::Engine::GPU;
+        else if (std::string(argv[i]) == "--greedy")
+            meshingMode = CellMeshingShader::Mode::Greedy;
+        else if (std::string(argv[i]) == "--vertex-pulling")
+            meshingMode = CellMeshingShader::Mode::VertexPulling;
+        else if (std::string(argv[i]) == "--face-masks")
+            faceMasks = true;
+    }
+
 	SDL_Init(SDL_INIT_VIDEO);
 	SDL_Window* window = SDL_CreateWindow("3D Cellular Automata", 
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
@@ -35,122 +65,13 @@ int main(int argc, char* argv[])
     if (depth > maxDimension)
         maxDimension = depth;
 
-    /* This lambda returns a function to generate random cells within a cube of
-       width w. Each cell has a probability of 1/n of being alive. */
-    auto randomCubeSeed = [](int n, int w)
-    {
-        return [n, w](uint32_t* cells, int width, int height, int depth)
-        {
-            for (int z = (depth - w) / 2; z < (depth + w) / 2; z++)
-            {
-                for (int y = (height - w) / 2; y < (height + w) / 2; y++)
-                {
-                    for (int x = (width - w) / 2; x < (width + w) / 2; x++)
-                    {
-                        if (rand() % n == 0)
-                            cells[x + y * width + z * width * height] = 1;
-                    }
-                }
-            }
-        };
-    };
-
-    // List of different automata names, rules, color schemes, and seed functions
-    std::vector<Automaton> automata
-    ({
-        Automaton
-        (
-            "Plasma", 
-            "B 4,5,10,14,21,25 / S 6,8,12,13,18,25 / 6",
-            { 0, 0x7e00ff, 0xff00f0, 0xb079ff, 0x3fa3ff, 0x00bcff },
-            randomCubeSeed(2, 6)
-        ),
-        Automaton
-        (
-            "Regular Growth", 
-            "B 5,13,21,22 / S 4,5,6,12,13,22,25 / 3",
-            { 0, 0xffff00, 0x7f7f00 },
-            randomCubeSeed(2, 10)
-        ),
-        Automaton
-        (
-            "Dissolve", 
-            "B 5,6,7,9,10,13,15,16,18,19,20,21,23 / S 8,10,12,15,17,21,26 / 4",
-            { 0, 0x2c2c2c, 0xa6a6a6, 0x666666 },
-            randomCubeSeed(5, 128)
-        ),
-        Automaton
-        (
-            "Fungus", 
-            "B 5,6,7,9 / S 3,6,9,10 / 6",
-            { 0, 0xaaa25c, 0x3d2800, 0x584317, 0x74612c, 0x8f8143 },
-            randomCubeSeed(2, 20)
-        ),
-        Automaton
-        (
-            "Cube", 
-            "B 1,2,3,4,5,6,7,11,16,17,21,25,26 / S 2,5,7,12,15,16,17,18,19,21,22,23,24 / 5",
-            { 0, 0xf24c3d, 0xf29727, 0x22a699, 0xf2be22 },
-            randomCubeSeed(1, 2)
-        ),
-        Automaton
-        (
-            "Tetradecahedron", 
-            "B 2,3,4,11,23,24 / S 1,2,14,16,17,20,24 / 9",
-            { 
-                0, 0x22a699, 0xf29727, 0xf24c3d, 0xf2be22, 0x1d5b79, 
-                0x468b97, 0xef6262, 0xf3aa60 
-            },
-            randomCubeSeed(1, 2)
-        ),
-        Automaton
-        (
-            "Life 3D", 
-            "B 7,11,12,13 / S 3,4,6,7,8,9,10,11 / 20",
-            { 
-                0, 0x510000, 0xff0000, 0xf50003, 0xeb0005, 0xe00007, 0xd60009, 
-                0xcc000a, 0xc2000b, 0xb8000c, 0xaf000c, 0xa5000c, 0x9b000c, 
-                0x91000c, 0x88000b, 0x7e000a, 0x750009, 0x6c0007, 0x630005, 
-                0x5a0003 
-            },
-            randomCubeSeed(2, 10)
-        ),
-        Automaton
-        (
-            "Heartbeat", 
-            "B 4,5,6 / S 1 / 25",
-            { 
-                0, 0xff0000, 0x1800ff, 0x0052ff, 0x0074ff, 0x008eff, 0x00a2ff, 
-                0x00b3ff, 0x00c2ff, 0x00d1e8, 0x00dfb9, 0x00eb88, 0x00f656, 
-                0x12ff00, 0x12ff00, 0x67f100, 0x8de200, 0xa7d200, 0xbdc100, 
-                0xcfb000, 0xde9d00, 0xea8900, 0xf47300, 0xfa5a00, 0xfe3c00 
-            },
-            randomCubeSeed(1, 2)
-        ),
-        Automaton
-        (
-            "Space Cars", 
-            "B 4,5 / S 10 / 15", 
-            {  
-                0, 0xff0000, 0xa200ff, 0xff008e, 0xff8c15, 0xfffc00, 0xffea00, 
-                0xffd800, 0xffc500, 0xffb100, 0xff9d00, 0xff8900, 0xff7300, 
-                0xff5a00, 0xff3c00 
-            },
-            randomCubeSeed(10, 20)
-        ),
-        Automaton
-        (
-            "Persist", 
-            "B 5,8,9 / S 2,11 / 2",
-            { 0, 0x956bb0 },
-            randomCubeSeed(11, width)
-        ),
-    });
+    // List of different automata names, rules, color schemes, and seeds
+    std::vector<Automaton> automata = getPresetAutomata(width);
 
     // Three shader stages: evaluate automata logic, generate mesh, render (vertex + fragment)
-    CellRulesShader cellRulesShader(width, height, depth, automata[0].rule);
-    CellMeshingShader cellMeshingShader(width, height, depth);
-    CellRenderShader cellRenderShader(width, height, depth, cellMeshingShader.getMeshSSBO());
+    CellRulesShader cellRulesShader(width, height, depth, automata[0].rule, engine, faceMasks);
+    CellMeshingShader cellMeshingShader(width, height, depth, meshingMode);
+    CellRenderShader cellRenderShader(width, height, depth, cellMeshingShader);
 
     uint32_t oldTime = SDL_GetTicks();
     bool quit = false;
@@ -159,25 +80,31 @@ int main(int argc, char* argv[])
     float xAngle = 0.0f;
     // Camera field of view in degrees (controlled with +/- keys)
     float fovAngle = 70.0f;
-    // Half second timer for printing framerate approximation
-    float fpsTimer = 0.0f;
+    // Half second timer for printing the frame profile
+    float profileTimer = 0.0f;
+    // CPU and GPU time of the simulation, meshing and rendering stages over the last few seconds
+    FrameProfiler frameProfiler;
     // Time between frames of simulation (controlled with mouse wheel)
     float frameDelay = 0.01f;
     // When simTimer > frameDelay, evaluate automaton logic
     float simTimer = 0.0f;
     // Current automaton rules being used (controlled with left/right keys)
     int automatonID = 0;
+    // Generation of the cells in the mesh buffer
+    uint64_t meshedGeneration = UINT64_MAX;
+    // Key of the random numbers of the next seed, a different one every run and every press of SPACE
+    uint32_t seedKey = static_cast<uint32_t>(time(nullptr));
     while (!quit) 
     {
         uint32_t newTime = SDL_GetTicks();
         float delta = (newTime - oldTime) / 1000.0f;
         oldTime = newTime;
 
-        fpsTimer += delta;
-        if (fpsTimer > 0.5f)
+        profileTimer += delta;
+        if (profileTimer > 0.5f)
         {
-            std::cout << "FPS: " << static_cast<int>(1.0f / delta) << std::endl;
-            fpsTimer = 0.0f;
+            std::cout << frameProfiler.getReport() << std::endl;
+            profileTimer = 0.0f;
         }
 
         SDL_Event event;
@@ -195,10 +122,8 @@ int main(int argc, char* argv[])
             {
                 if (event.key.keysym.sym == SDL_KeyCode::SDLK_SPACE)
                 {
-                    // Fetch current cell grid from GPU, add cells using seed function, send cell grid back to GPU
-                    cellRulesShader.fetchGPUCells();
-                    automata[automatonID].seedFunction(cellRulesShader.getCells(), width, height, depth);
-                    cellRulesShader.updateGPUCells();
+                    // Add cells using the seed of the automaton, directly into the GPU cell buffer
+                    cellRulesShader.seedCells(automata[automatonID].seed, seedKey++);
                 }
                 else if (event.key.keysym.sym == SDL_KeyCode::SDLK_LEFT)
                 {
@@ -206,6 +131,7 @@ int main(int argc, char* argv[])
                     if (automatonID < 0)
                         automatonID = automata.size() - 1;
                     cellRulesShader.setRule(automata[automatonID].rule);
+                    meshedGeneration = UINT64_MAX;
                 }
                 else if (event.key.keysym.sym == SDL_KeyCode::SDLK_RIGHT)
                 {
@@ -213,6 +139,12 @@ int main(int argc, char* argv[])
                     if (automatonID > automata.size() - 1)
                         automatonID = 0;
                     cellRulesShader.setRule(automata[automatonID].rule);
+                    meshedGeneration = UINT64_MAX;
+                }
+                else if (event.key.keysym.sym == SDL_KeyCode::SDLK_j)
+                {
+                    // Jump ahead 2^16 generations, which is only fast with the HashLife engine
+                    cellRulesShader.simulate(static_cast<uint64_t>(1) << 16);
                 }
                 else if (event.key.keysym.sym == SDL_KeyCode::SDLK_EQUALS)
                 {
@@ -255,17 +187,31 @@ int main(int argc, char* argv[])
         {
             simTimer = 0.0f;
             // Represents one timestep of cellular automaton
+            frameProfiler.beginStage("simulate");
             cellRulesShader.simulate();
+            frameProfiler.endStage();
         }
-        /* 6 meshing/rendering stages, one for each side of each cube.
-           For example, at i=0, every cube's left side is meshed and rendered. */
-        for (int i = 0; i < 6; i++)
+        /* Meshing shader takes in cell state buffer as input and outputs the faces of every side of each cube to the vertex buffer.
+           Frames where the cells didn't change (e.g. the camera only moved) render the last mesh again. Changing the
+           automaton keeps the cells but changes the color scheme, so it resets meshedGeneration to mesh again. */
+        if (cellRulesShader.getGeneration() != meshedGeneration || cellMeshingShader.isMeshTruncated())
         {
-            // Meshing shader takes in cell state buffer as input and outputs to vertex buffer
-            cellMeshingShader.meshCells(cellRulesShader.getCellSSBO(), i, automata[automatonID].colorScheme);
-            // Render shader uses glDrawArrays to render the mesh created by the meshing shader
-            cellRenderShader.renderMesh(mvp, i);
+            frameProfiler.beginStage("mesh");
+            /* The face masks are of the generation before the current one, so with --face-masks the displayed cells lag
+               one generation behind the simulation. Without valid masks (e.g. right after seeding) mesh the current cells. */
+            GLuint faceMaskCellSSBO = cellRulesShader.getFaceMaskCellSSBO();
+            if (faceMaskCellSSBO != 0)
+                cellMeshingShader.meshCells(faceMaskCellSSBO, cellRulesShader.getFaceCountSSBO(), CellMeshingShader::ALL_STAGES, automata[automatonID].colorScheme, cellRulesShader.getFaceMaskSSBO());
+            else
+                cellMeshingShader.meshCells(cellRulesShader.getCellSSBO(), cellRulesShader.getBrickFlagSSBO(), CellMeshingShader::ALL_STAGES, automata[automatonID].colorScheme);
+            frameProfiler.endStage();
+            meshedGeneration = cellRulesShader.getGeneration();
         }
+        // Render shader uses glDrawArraysIndirect to render the faces appended by the meshing shader
+        frameProfiler.beginStage("render");
+        cellRenderShader.renderMesh(mvp);
+        frameProfiler.endStage();
+        frameProfiler.endFrame();
 
         SDL_GL_SwapWindow(window);
         SDL_Delay(1);